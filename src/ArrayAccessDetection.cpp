@@ -1,14 +1,19 @@
 #include "ArrayAccessDetection.h"
 #include "CommonDef.h"
 #include "llvm/ADT/SmallSet.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/Regex.h"
 
 using namespace llvm;
 
 static Value *INVALID_BOUND = reinterpret_cast<Value *>(0xFFFFFFFFFFFFFFFFU);
 
 MDTuple *ArrayAccessDetection::calculateBoundforGEP(
-    GetElementPtrInst *GI, DenseMap<Value *, CallBase *> &ValueSource,
-    DenseMap<CallBase *, Value *> &MallocBound) {
+    GetElementPtrInst *GI, DenseMap<Value *, Value *> &ValueSource,
+    DenseMap<std::pair<Value *, Type *>, Value *> &MallocBound) {
   LLVMContext &Context = GI->getFunction()->getContext();
   if (GI->getSourceElementType()->isArrayTy()) {
     GI->print(verboseOut());
@@ -26,36 +31,65 @@ MDTuple *ArrayAccessDetection::calculateBoundforGEP(
                       GI->getSourceElementType()->getArrayNumElements()))});
   }
 
-  CallBase *Allocator = nullptr;
-  Value *Base = GI->getPointerOperand();
-  while (Base) {
-    Value *BaseBefore = Base;
-    if (isa<LoadInst>(Base)) {
-      auto Iter = ValueSource.find(Base);
-      if (Iter != ValueSource.end()) {
-        Base = Iter->getSecond();
-      }
-    } else if (isa<CallBase>(Base)) {
-      CallBase *CB = cast<CallBase>(Base);
-      if (CB->getCalledFunction()->getName() == "malloc") {
-        Allocator = CB;
-      }
+  // `p[i].field` indexes a pointer with more than one index, the subscript
+  // check-ins would pick is the field number
+  if (GI->getNumIndices() != 1) {
+    return nullptr;
+  }
+
+  SmallPtrSet<PHINode *, 8> VisitingPhis;
+  Value *Allocator =
+      findBaseObject(GI->getPointerOperand(), ValueSource, VisitingPhis);
+
+  if (Allocator && isStaticArrayObject(Allocator)) {
+    // a pointer to the first element of a global or stack array
+    const DataLayout &DL = GI->getModule()->getDataLayout();
+    uint64_t ElemSize =
+        DL.getTypeAllocSize(GI->getSourceElementType()).getFixedSize();
+    uint64_t ObjectSize =
+        DL.getTypeAllocSize(getStaticArrayType(Allocator)).getFixedSize();
+    if (ElemSize == 0 || ObjectSize % ElemSize != 0) {
+      return nullptr;
     }
-    if (BaseBefore == Base) {
-      break;
+    GI->print(verboseOut());
+    verboseOut() << "\n  Bound: " << ObjectSize / ElemSize << "\n  Object: ";
+    Allocator->printAsOperand(verboseOut());
+    verboseOut() << "\n";
+    return MDNode::get(
+        Context, {MDString::get(Context, "static array"),
+                  ConstantAsMetadata::get(ConstantInt::get(
+                      Type::getInt64Ty(Context), ObjectSize / ElemSize))});
+  }
+
+  if (Allocator && isa<Argument>(Allocator)) {
+    Value *Count = getParameterBound(cast<Argument>(Allocator),
+                                     GI->getSourceElementType());
+    if (!Count) {
+      return nullptr;
     }
+    GI->print(verboseOut());
+    verboseOut() << "\n  Bound: ";
+    Count->printAsOperand(verboseOut());
+    verboseOut() << "\n";
+    return MDNode::get(Context, {MDString::get(Context, "parameter array"),
+                                 ValueAsMetadata::get(Count),
+                                 ValueAsMetadata::get(Allocator)});
   }
 
   if (Allocator) {
     Value *Bound;
-    auto Iter = MallocBound.find(Allocator);
+    auto Key = std::make_pair(Allocator, GI->getSourceElementType());
+    auto Iter = MallocBound.find(Key);
     if (Iter == MallocBound.end()) {
-      Bound = tackleMalloc(Allocator, GI->getResultElementType());
-      MallocBound.insert({Allocator, Bound});
+      Bound = tackleMalloc(cast<Instruction>(Allocator), Key.second);
+      MallocBound.insert({Key, Bound});
     } else {
       Bound = Iter->getSecond();
     }
-    if (Bound == INVALID_BOUND) {
+    // the allocation may sit on a path that does not reach every access
+    auto *BoundInst = dyn_cast<Instruction>(Bound);
+    if (Bound == INVALID_BOUND ||
+        (BoundInst && !DT->dominates(BoundInst, GI))) {
       return nullptr;
     } else {
       GI->print(verboseOut());
@@ -72,18 +106,261 @@ MDTuple *ArrayAccessDetection::calculateBoundforGEP(
                                    ValueAsMetadata::get(Bound),
                                    ValueAsMetadata::get(Allocator)});
     }
+  } else if (RUNTIME_BOUNDS_TABLE && isRuntimeBoundCandidate(GI)) {
+    // the bound of the base pointer is looked up when the check runs
+    GI->print(verboseOut());
+    verboseOut() << "\n  Bound: runtime lookup\n";
+    return MDNode::get(Context,
+                       {MDString::get(Context, "runtime array"),
+                        ValueAsMetadata::get(GI->getPointerOperand())});
+  } else {
+    return nullptr;
+  }
+}
+
+/**
+ * @brief The array type of a global or a static alloca of array type, or
+ * nullptr for any other value.
+ */
+ArrayType *ArrayAccessDetection::getStaticArrayType(Value *V) {
+  Type *Ty = nullptr;
+  if (auto *GV = dyn_cast<GlobalVariable>(V)) {
+    Ty = GV->getValueType();
+  } else if (auto *AI = dyn_cast<AllocaInst>(V)) {
+    if (AI->isStaticAlloca() && !AI->isArrayAllocation()) {
+      Ty = AI->getAllocatedType();
+    }
+  }
+  // `extern int a[];` is declared with zero elements
+  auto *ATy = dyn_cast_or_null<ArrayType>(Ty);
+  return ATy && ATy->getNumElements() > 0 ? ATy : nullptr;
+}
+
+bool ArrayAccessDetection::isStaticArrayObject(Value *V) {
+  return getStaticArrayType(V) != nullptr;
+}
+
+/**
+ * @brief Follow a pointer through casts, array decays, copies in stack slots
+ * and global pointers, and phis and selects, to the object it points to the
+ * start of: a static array, a malloc call or a bounded parameter.
+ *
+ * @return nullptr if the object is unknown, or may be one of several
+ */
+Value *ArrayAccessDetection::findBaseObject(
+    Value *Base, DenseMap<Value *, Value *> &ValueSource,
+    SmallPtrSetImpl<PHINode *> &VisitingPhis) {
+  Base = stripZeroOffsets(Base);
+  if (isStaticArrayObject(Base)) {
+    return Base;
+  } else if (isa<LoadInst>(Base)) {
+    auto Iter = ValueSource.find(Base);
+    return Iter != ValueSource.end() ? Iter->getSecond() : nullptr;
+  } else if (isa<CallBase>(Base)) {
+    return isAllocationCall(Base) ? Base : nullptr;
+  } else if (isa<AllocaInst>(Base)) {
+    // a VLA, or `alloca T, n`
+    return cast<AllocaInst>(Base)->isArrayAllocation() ? Base : nullptr;
+  } else if (auto *Arg = dyn_cast<Argument>(Base)) {
+    // parameter of a clone made by bound-clone, its count is passed along, or
+    // whose size the source declares
+    return getArrayBoundArgument(*Arg) || DeclaredBounds.count(Arg) ||
+                   Arg->getDereferenceableBytes()
+               ? Base
+               : nullptr;
+  }
+
+  SmallVector<Value *, 4> Incomings;
+  if (auto *PN = dyn_cast<PHINode>(Base)) {
+    // a phi on a cycle adds no new object
+    if (!VisitingPhis.insert(PN).second) {
+      return Base;
+    }
+    Incomings.append(PN->op_begin(), PN->op_end());
+  } else if (auto *SI = dyn_cast<SelectInst>(Base)) {
+    Incomings.append({SI->getTrueValue(), SI->getFalseValue()});
   } else {
     return nullptr;
   }
+  Value *Object = nullptr;
+  for (auto *Incoming : Incomings) {
+    Value *IncomingObject = findBaseObject(Incoming, ValueSource, VisitingPhis);
+    if (!IncomingObject) {
+      return nullptr;
+    } else if (isa<PHINode>(IncomingObject)) {
+      continue;
+    } else if (Object && Object != IncomingObject) {
+      return nullptr;
+    }
+    Object = IncomingObject;
+  }
+  return Object;
+}
+
+/**
+ * @brief A pointer slot is followed if its address does not escape and
+ * every store to it stores the same static array. Global pointers are
+ * resolved across the module, which must then be the whole program.
+ *
+ * @return the array, or nullptr
+ */
+Value *ArrayAccessDetection::resolveGlobalPointer(GlobalVariable *GV) {
+  const Function *Main = GV->getParent()->getFunction("main");
+  if (!GV->getValueType()->isPointerTy() || !GV->hasDefinitiveInitializer() ||
+      (!GV->hasLocalLinkage() && (!Main || Main->isDeclaration()))) {
+    return nullptr;
+  }
+  Value *Object = nullptr;
+  if (!GV->getInitializer()->isNullValue()) {
+    Object = stripZeroOffsets(GV->getInitializer());
+    if (!isStaticArrayObject(Object)) {
+      return nullptr;
+    }
+  }
+  for (auto *U : GV->users()) {
+    if (isa<LoadInst>(U))
+      continue;
+    auto *SI = dyn_cast<StoreInst>(U);
+    if (!SI || SI->getPointerOperand() != GV) {
+      return nullptr;
+    }
+    Value *Stored = stripZeroOffsets(SI->getValueOperand());
+    if (!isStaticArrayObject(Stored) || (Object && Object != Stored)) {
+      return nullptr;
+    }
+    Object = Stored;
+  }
+  // a stack array of another function is not visible in this one
+  return dyn_cast_or_null<GlobalVariable>(Object);
+}
+
+/**
+ * @brief `p[i]` on a pointer the detection cannot trace: loaded from a global
+ * or a structure, or returned by a call. Field accesses and stack or global
+ * objects, which the table never holds, are left alone.
+ */
+bool ArrayAccessDetection::isRuntimeBoundCandidate(GetElementPtrInst *GI) {
+  Type *SourceType = GI->getSourceElementType();
+  if (GI->getNumIndices() != 1 || SourceType->isStructTy() ||
+      SourceType->isArrayTy() || !SourceType->isSized()) {
+    return false;
+  }
+  Value *Base = GI->getPointerOperand()->stripPointerCasts();
+  return !isa<AllocaInst>(Base) && !isa<GlobalVariable>(Base);
+}
+
+/**
+ * @brief The parameter of F named Name, by its IR name or, when clang
+ * discarded value names, by its name in the debug info.
+ */
+static Argument *findParameterByName(Function &F, StringRef Name) {
+  for (auto &Arg : F.args()) {
+    if (Arg.getName() == Name)
+      return &Arg;
+  }
+  for (auto &I : instructions(F)) {
+    auto *DDI = dyn_cast<DbgVariableIntrinsic>(&I);
+    if (!DDI)
+      continue;
+    DILocalVariable *Var = DDI->getVariable();
+    if (Var->isParameter() && Var->getName() == Name &&
+        Var->getArg() <= F.arg_size())
+      return F.getArg(Var->getArg() - 1);
+  }
+  return nullptr;
+}
+
+/**
+ * @brief Read `__attribute__((annotate("bound:n")))` on pointer parameters:
+ * the parameter has n elements, n being another parameter or a constant.
+ * clang lowers the annotation to llvm.var.annotation on the stack slot the
+ * parameter is spilled to, which keeps the slot from being promoted.
+ */
+void ArrayAccessDetection::readParameterAnnotations(Function &F) {
+  DeclaredBounds.clear();
+  for (auto &I : instructions(F)) {
+    auto *II = dyn_cast<IntrinsicInst>(&I);
+    if (!II || II->getIntrinsicID() != Intrinsic::var_annotation)
+      continue;
+    auto *Slot =
+        dyn_cast<AllocaInst>(II->getArgOperand(0)->stripPointerCasts());
+    auto *GV =
+        dyn_cast<GlobalVariable>(II->getArgOperand(1)->stripPointerCasts());
+    if (!Slot || !GV || !GV->hasInitializer())
+      continue;
+    auto *Str = dyn_cast<ConstantDataArray>(GV->getInitializer());
+    if (!Str || !Str->isCString())
+      continue;
+    StringRef CountName = Str->getAsCString();
+    if (!CountName.consume_front("bound:"))
+      continue;
+    CountName = CountName.trim();
+
+    // the parameter spilled to the slot
+    Argument *Array = nullptr;
+    for (auto *U : Slot->users()) {
+      auto *SI = dyn_cast<StoreInst>(U);
+      if (SI && SI->getPointerOperand() == Slot)
+        Array = dyn_cast<Argument>(SI->getValueOperand());
+    }
+    if (!Array || !Array->getType()->isPointerTy())
+      continue;
+
+    Value *Count = nullptr;
+    uint64_t Constant;
+    if (!CountName.getAsInteger(0, Constant)) {
+      Count = ConstantInt::get(Type::getInt64Ty(F.getContext()), Constant);
+    } else if (Argument *CountArg = findParameterByName(F, CountName)) {
+      if (!CountArg->getType()->isIntegerTy())
+        continue;
+      Count = CountArg;
+      if (!CountArg->getType()->isIntegerTy(64)) {
+        IRBuilder<> IRB(&*F.getEntryBlock().getFirstInsertionPt());
+        Count = IRB.CreateSExt(CountArg, IRB.getInt64Ty(),
+                               CountArg->getName() + ".count");
+      }
+    }
+    if (!Count) {
+      verboseOut() << "Unknown bound in annotation \"" << Str->getAsCString()
+                   << "\" of " << F.getName() << "\n";
+      continue;
+    }
+    DeclaredBounds[Array] = Count;
+  }
+}
+
+/**
+ * @brief The element count of a pointer parameter indexed with ElementTy:
+ * passed in another parameter by bound-clone, declared by an annotation, or
+ * implied by the dereferenceable attribute, e.g. of `int a[static 8]`.
+ */
+Value *ArrayAccessDetection::getParameterBound(Argument *Arg,
+                                               Type *ElementTy) {
+  if (Argument *Count = getArrayBoundArgument(*Arg)) {
+    return Count;
+  }
+  if (Value *Count = DeclaredBounds.lookup(Arg)) {
+    return Count;
+  }
+  const DataLayout &DL = Arg->getParent()->getParent()->getDataLayout();
+  uint64_t Bytes = Arg->getDereferenceableBytes();
+  uint64_t ElemSize = DL.getTypeAllocSize(ElementTy).getFixedSize();
+  if (Bytes == 0 || ElemSize == 0 || Bytes % ElemSize != 0) {
+    return nullptr;
+  }
+  return ConstantInt::get(Type::getInt64Ty(Arg->getContext()),
+                          Bytes / ElemSize);
 }
 
 void ArrayAccessDetection::tackleGEP(
-    GetElementPtrInst *GI, DenseMap<Value *, CallBase *> &ValueSource,
-    DenseMap<CallBase *, Value *> &MallocBound) {
+    GetElementPtrInst *GI, DenseMap<Value *, Value *> &ValueSource,
+    DenseMap<std::pair<Value *, Type *>, Value *> &MallocBound) {
   Type *SourceType = GI->getSourceElementType();
   Type *ResultType = GI->getResultElementType();
-  // only tackle access to non-array elment
-  if (SourceType->isVectorTy()) {
+  // fixed vectors are indexed in whole vectors like any other element, the
+  // size of scalable ones is only known at run time
+  if (isa<ScalableVectorType>(SourceType) ||
+      isa<ScalableVectorType>(GI->getType())) {
     return;
   }
   MDTuple *MT = calculateBoundforGEP(GI, ValueSource, MallocBound);
@@ -92,29 +369,128 @@ void ArrayAccessDetection::tackleGEP(
   }
 }
 
-Value *ArrayAccessDetection::tackleMalloc(CallBase *CB, Type *ElementTy) {
-  Value *Size = CB->getArgOperand(0);
-  Module *M = CB->getFunction()->getParent();
-  Value *Bound = INVALID_BOUND;
-  uint64_t ElemSizeInByte =
-      M->getDataLayout().getTypeSizeInBits(ElementTy).getFixedSize() / 8;
-  if (isa<BinaryOperator>(Size)) {
-    BinaryOperator *BO = cast<BinaryOperator>(Size);
-    if (BO->getOpcode() == Instruction::Mul) {
-      Value *Op1 = BO->getOperand(0);
-      Value *Op2 = BO->getOperand(1);
-      if (isa<ConstantInt>(Op1) &&
-          cast<ConstantInt>(Op1)->getZExtValue() == ElemSizeInByte) {
-        Bound = Op2;
-      } else if (isa<ConstantInt>(Op2) &&
-                 cast<ConstantInt>(Op2)->getZExtValue() == ElemSizeInByte) {
-        Bound = Op1;
-      } else {
-        Bound = INVALID_BOUND;
+/**
+ * @brief The element count of a heap allocation or a VLA, materialized right
+ * after it when the size operand is not an exact multiple of the element.
+ */
+Value *ArrayAccessDetection::tackleMalloc(Instruction *Allocation,
+                                          Type *ElementTy) {
+  const DataLayout &DL = Allocation->getModule()->getDataLayout();
+  Instruction *InsertPoint = Allocation->getNextNode();
+  if (auto *II = dyn_cast<InvokeInst>(Allocation)) {
+    // `new[]` may be invoked, the count is computed on the normal path
+    if (!II->getNormalDest()->getSinglePredecessor()) {
+      return INVALID_BOUND;
+    }
+    InsertPoint = &*II->getNormalDest()->getFirstInsertionPt();
+  }
+  IRBuilder<> IRB(InsertPoint);
+  Value *Bound = getAllocationElementCount(
+      IRB, Allocation, DL.getTypeAllocSize(ElementTy).getFixedSize());
+  return Bound ? Bound : INVALID_BOUND;
+}
+
+// operator[] and at() of std::vector and std::array, with the ABI tag libc++
+// puts on its inline members, e.g. `operator[][abi:v160006]`
+static const Regex &getContainerSubscriptRegex() {
+  static const Regex Subscript(
+      "^std::(__1::)?(vector|array)<(.*)>::"
+      "(operator\\[\\]|at)(\\[abi:[^]]*\\])?\\(unsigned long\\)( const)?$");
+  return Subscript;
+}
+
+/**
+ * @brief The element type a container member indexes its begin pointer with.
+ * libstdc++'s at() has no GEP of its own, it checks the range and calls
+ * operator[], whose GEP is used then.
+ */
+static Type *getIndexedElementType(Function &Callee) {
+  for (auto &I : instructions(Callee)) {
+    auto *GI = dyn_cast<GetElementPtrInst>(&I);
+    if (GI && GI->getNumIndices() == 1) {
+      return GI->getSourceElementType();
+    }
+  }
+  SmallVector<StringRef, 7> Matches;
+  for (auto &I : instructions(Callee)) {
+    auto *Inner = dyn_cast<CallBase>(&I);
+    Function *InnerCallee = Inner ? Inner->getCalledFunction() : nullptr;
+    if (!InnerCallee || InnerCallee->isDeclaration())
+      continue;
+    std::string Name = demangle(InnerCallee->getName().str());
+    if (!getContainerSubscriptRegex().match(Name, &Matches) ||
+        Matches[4] != "operator[]")
+      continue;
+    for (auto &J : instructions(*InnerCallee)) {
+      auto *GI = dyn_cast<GetElementPtrInst>(&J);
+      if (GI && GI->getNumIndices() == 1) {
+        return GI->getSourceElementType();
       }
     }
   }
-  return Bound;
+  return nullptr;
+}
+
+/**
+ * @brief `operator[]` and `at()` of std::vector and std::array, which stay
+ * calls until they are inlined. An array has its element count in its type.
+ * A vector's count is computed before the call from its begin and end
+ * pointers, which are its first two members in libstdc++ and libc++.
+ */
+MDTuple *ArrayAccessDetection::tackleContainerSubscript(CallBase *CB) {
+  Function *Callee = CB->getCalledFunction();
+  if (!Callee || Callee->isDeclaration() || CB->arg_size() != 2 ||
+      !CB->getArgOperand(1)->getType()->isIntegerTy(64)) {
+    return nullptr;
+  }
+  std::string Name = demangle(Callee->getName().str());
+  SmallVector<StringRef, 7> Matches;
+  if (!getContainerSubscriptRegex().match(Name, &Matches)) {
+    return nullptr;
+  }
+  LLVMContext &Context = CB->getContext();
+  StringRef TemplateArgs = Matches[3];
+
+  if (Matches[2] == "array") {
+    // std::array<int, 10ul>
+    StringRef Count = TemplateArgs.rsplit(", ").second.rtrim("ul");
+    uint64_t N;
+    if (Count.getAsInteger(10, N)) {
+      return nullptr;
+    }
+    verboseOut() << "std::array subscript of " << N << " elements\n";
+    return MDNode::get(Context, {MDString::get(Context, "container array"),
+                                 ConstantAsMetadata::get(ConstantInt::get(
+                                     Type::getInt64Ty(Context), N))});
+  }
+
+  // the bit vector specialization has no element array to index
+  if (TemplateArgs.startswith("bool,")) {
+    return nullptr;
+  }
+  Type *ElementTy = getIndexedElementType(*Callee);
+  const DataLayout &DL = CB->getModule()->getDataLayout();
+  if (!ElementTy || !ElementTy->isSized() ||
+      DL.getTypeAllocSize(ElementTy).getFixedSize() == 0) {
+    return nullptr;
+  }
+
+  IRBuilder<> IRB(CB);
+  Value *This = CB->getArgOperand(0);
+  Value *EndAddr = IRB.CreateConstInBoundsGEP1_64(
+      IRB.getInt8Ty(), This, DL.getPointerSize(), "vec.end.addr");
+  Value *Begin = IRB.CreatePtrToInt(
+      IRB.CreateLoad(IRB.getPtrTy(), This, "vec.begin"), IRB.getInt64Ty());
+  Value *End = IRB.CreatePtrToInt(
+      IRB.CreateLoad(IRB.getPtrTy(), EndAddr, "vec.end"), IRB.getInt64Ty());
+  Value *Bound = IRB.CreateExactSDiv(
+      IRB.CreateSub(End, Begin),
+      IRB.getInt64(DL.getTypeAllocSize(ElementTy).getFixedSize()),
+      "vec.size");
+  verboseOut() << "std::vector subscript in " << Callee->getName() << "\n";
+  return MDNode::get(Context, {MDString::get(Context, "container array"),
+                               ValueAsMetadata::get(Bound),
+                               ValueAsMetadata::get(This)});
 }
 
 PreservedAnalyses ArrayAccessDetection::run(Function &F,
@@ -123,9 +499,43 @@ PreservedAnalyses ArrayAccessDetection::run(Function &F,
     return PreservedAnalyses::all();
   }
   verboseOut() << "Detect Array Access in " << F.getName() << "\n";
+  DT = &FAM.getResult<DominatorTreeAnalysis>(F);
   // SmallSet<CallBase *, 16> MallocSet;
-  DenseMap<Value *, CallBase *> ValueSource;
-  DenseMap<CallBase *, Value *> MallocBound;
+  DenseMap<Value *, Value *> ValueSource;
+  // bounds are counted in elements, per allocation and element type
+  DenseMap<std::pair<Value *, Type *>, Value *> MallocBound;
+  readParameterAnnotations(F);
+  for (auto &Arg : F.args()) {
+    if (getArrayBoundArgument(Arg) || DeclaredBounds.count(&Arg)) {
+      ValueSource.insert({&Arg, &Arg});
+    }
+  }
+  // -O0 code spills pointers to stack slots; a slot is only followed if it
+  // is stored to once and its address does not escape
+  SmallPtrSet<Value *, 16> TrackedSlots;
+  for (auto &I : instructions(F)) {
+    auto *AI = dyn_cast<AllocaInst>(&I);
+    if (!AI || !AI->getAllocatedType()->isPointerTy())
+      continue;
+    unsigned Stores = 0;
+    bool Escapes = false;
+    for (auto *U : AI->users()) {
+      if (auto *SI = dyn_cast<StoreInst>(U)) {
+        Escapes |= SI->getPointerOperand() != AI;
+        Stores++;
+      } else {
+        // annotated parameters keep their slot, the annotation reads nothing
+        auto *II = dyn_cast<IntrinsicInst>(U);
+        Escapes |= !isa<LoadInst>(U) &&
+                   !(II && II->getIntrinsicID() == Intrinsic::var_annotation);
+      }
+    }
+    if (!Escapes && Stores == 1) {
+      TrackedSlots.insert(AI);
+    }
+  }
+  SmallPtrSet<GlobalVariable *, 8> ResolvedGlobals;
+
   for (auto &BB : F) {
     for (auto &I : BB) {
       if (isa<GetElementPtrInst>(&I)) {
@@ -133,20 +543,29 @@ PreservedAnalyses ArrayAccessDetection::run(Function &F,
         tackleGEP(GI, ValueSource, MallocBound);
       } else if (isa<CallBase>(&I)) {
         CallBase *CB = cast<CallBase>(&I);
-        if (CB->getCalledFunction() &&
-            CB->getCalledFunction()->getName() == "malloc") {
+        if (isAllocationCall(CB)) {
           ValueSource.insert({CB, CB});
+        } else if (MDTuple *MT = tackleContainerSubscript(CB)) {
+          CB->setMetadata(ACCESS_KEY, MT);
         }
       } else if (isa<StoreInst>(&I)) {
         StoreInst *SI = cast<StoreInst>(&I);
-        Value *Source = SI->getValueOperand();
-        auto Iter = ValueSource.find(Source);
-        if (Iter != ValueSource.end()) {
-          ValueSource.insert({SI->getPointerOperand(), Iter->getSecond()});
+        if (!TrackedSlots.contains(SI->getPointerOperand()))
+          continue;
+        SmallPtrSet<PHINode *, 8> VisitingPhis;
+        if (Value *Object = findBaseObject(SI->getValueOperand(), ValueSource,
+                                           VisitingPhis)) {
+          ValueSource.insert({SI->getPointerOperand(), Object});
         }
       } else if (isa<LoadInst>(&I)) {
         LoadInst *LI = cast<LoadInst>(&I);
         Value *Pointer = LI->getPointerOperand();
+        auto *GV = dyn_cast<GlobalVariable>(Pointer);
+        if (GV && ResolvedGlobals.insert(GV).second) {
+          if (Value *Object = resolveGlobalPointer(GV)) {
+            ValueSource.insert({GV, Object});
+          }
+        }
         auto Iter = ValueSource.find(Pointer);
         if (Iter != ValueSource.end()) {
           ValueSource.insert({LI, Iter->getSecond()});
@@ -154,8 +573,11 @@ PreservedAnalyses ArrayAccessDetection::run(Function &F,
       }
     }
   }
-  
-  return PreservedAnalyses::all();
+
+  // element counts may have been materialized, the CFG is untouched
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  return PA;
 }
 
 ArrayAccessDetection::~ArrayAccessDetection() {}
\ No newline at end of file
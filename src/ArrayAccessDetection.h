@@ -2,8 +2,10 @@
 #define ARRAY_ACCESS_DETECTION_H
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/LLVMContext.h"
 
@@ -11,11 +13,24 @@ class ArrayAccessDetection : public llvm::PassInfoMixin<ArrayAccessDetection>
 {
 public:
   llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &FAM);
-  llvm::MDTuple *calculateBoundforGEP(llvm::GetElementPtrInst *GI, llvm::DenseMap<llvm::Value *, llvm::CallBase *> &ValueSource, llvm::DenseMap<llvm::CallBase *, llvm::Value *> &MallocBound);
-  void tackleGEP(llvm::GetElementPtrInst *GI, llvm::DenseMap<llvm::Value *, llvm::CallBase *> &ValueSource, llvm::DenseMap<llvm::CallBase *, llvm::Value *> &MallocBound);
-  llvm::Value *tackleMalloc(llvm::CallBase *CB, llvm::Type *ElementTy);
+  llvm::MDTuple *calculateBoundforGEP(llvm::GetElementPtrInst *GI, llvm::DenseMap<llvm::Value *, llvm::Value *> &ValueSource, llvm::DenseMap<std::pair<llvm::Value *, llvm::Type *>, llvm::Value *> &MallocBound);
+  void tackleGEP(llvm::GetElementPtrInst *GI, llvm::DenseMap<llvm::Value *, llvm::Value *> &ValueSource, llvm::DenseMap<std::pair<llvm::Value *, llvm::Type *>, llvm::Value *> &MallocBound);
+  llvm::Value *tackleMalloc(llvm::Instruction *Allocation, llvm::Type *ElementTy);
+  llvm::MDTuple *tackleContainerSubscript(llvm::CallBase *CB);
+  bool isRuntimeBoundCandidate(llvm::GetElementPtrInst *GI);
+  llvm::ArrayType *getStaticArrayType(llvm::Value *V);
+  bool isStaticArrayObject(llvm::Value *V);
+  llvm::Value *findBaseObject(llvm::Value *Base, llvm::DenseMap<llvm::Value *, llvm::Value *> &ValueSource, llvm::SmallPtrSetImpl<llvm::PHINode *> &VisitingPhis);
+  llvm::Value *resolveGlobalPointer(llvm::GlobalVariable *GV);
+  void readParameterAnnotations(llvm::Function &F);
+  llvm::Value *getParameterBound(llvm::Argument *Arg, llvm::Type *ElementTy);
   static bool isRequired() { return true; }
   virtual ~ArrayAccessDetection();
+
+private:
+  llvm::DominatorTree *DT = nullptr;
+  // element counts the source declares for pointer parameters, as i64
+  llvm::DenseMap<llvm::Argument *, llvm::Value *> DeclaredBounds;
 };
 
 #endif // ARRAY_ACCESS_DETECTION_H
\ No newline at end of file
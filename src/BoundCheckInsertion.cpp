@@ -1,8 +1,131 @@
 #include "BoundCheckInsertion.h"
+#include "CheckGuards.h"
 #include "CommonDef.h"
+#include "Stats.h"
+#include "SubscriptExpr.h"
+#include "llvm/Analysis/LazyValueInfo.h"
+#include "llvm/IR/ConstantRange.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 using namespace llvm;
 
+/**
+ * @brief Whether memory may be written through Ptr: by a store to it, as the
+ * destination of a memory intrinsic or a masked store, after it escapes to a
+ * call that may write or into memory, or through a pointer a call returns.
+ */
+static bool mayWriteThrough(const Value *Ptr) {
+  SmallVector<const Value *, 8> Worklist{Ptr};
+  SmallPtrSet<const Value *, 8> Visited{Ptr};
+  while (!Worklist.empty()) {
+    const Value *V = Worklist.pop_back_val();
+    for (const auto *U : V->users()) {
+      if (isa<LoadInst>(U) || isa<ICmpInst>(U))
+        continue;
+      // storing the pointer itself lets anyone write through it
+      if (isa<StoreInst>(U))
+        return true;
+      if (isa<GetElementPtrInst>(U) || isa<BitCastInst>(U) ||
+          isa<PHINode>(U) || isa<SelectInst>(U)) {
+        if (Visited.insert(U).second)
+          Worklist.push_back(U);
+        continue;
+      }
+      const auto *CB = dyn_cast<CallBase>(U);
+      if (!CB)
+        return true;
+      if (const auto *MTI = dyn_cast<MemTransferInst>(CB)) {
+        if (MTI->getRawDest() == V)
+          return true;
+        continue;
+      }
+      const auto *II = dyn_cast<IntrinsicInst>(CB);
+      if (II && (II->isAssumeLikeIntrinsic() || II->isLifetimeStartOrEnd() ||
+                 II->getIntrinsicID() == Intrinsic::masked_load ||
+                 II->getIntrinsicID() == Intrinsic::masked_gather))
+        continue;
+      // memset, masked stores and scatters write, so may unknown callees
+      bool PassesPointer = false;
+      for (const auto &Arg : CB->args()) {
+        if (Arg.get() != V)
+          continue;
+        unsigned ArgNo = CB->getArgOperandNo(&Arg);
+        if (!CB->onlyReadsMemory(ArgNo))
+          return true;
+        // a callee that writes memory may keep the pointer and write later
+        if (!CB->doesNotCapture(ArgNo) && !CB->onlyReadsMemory())
+          return true;
+        PassesPointer = true;
+      }
+      // a readonly callee may still hand the pointer back, like strchr
+      if (PassesPointer && CB->getType()->isPtrOrPtrVectorTy() &&
+          Visited.insert(CB).second)
+        Worklist.push_back(CB);
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Whether every user of GEP accesses memory through it. Only then may
+ * INDEX_MASKING clamp its subscript: an address that is kept or compared,
+ * like the end pointer `&a[n]` of a loop, must not move.
+ */
+static bool isOnlyDereferenced(const GetElementPtrInst *GEP) {
+  return all_of(GEP->users(), [&](const User *U) {
+    return getAccessedPointer(cast<Instruction>(U)) == GEP;
+  });
+}
+
+/**
+ * @brief Whether the function may be left at I, by returning, unwinding or a
+ * call that does not come back.
+ */
+static bool mayLeaveFunction(const Instruction &I) {
+  if (isa<ReturnInst>(I) || isa<ResumeInst>(I))
+    return true;
+  const auto *CB = dyn_cast<CallBase>(&I);
+  return CB && !(CB->willReturn() && CB->doesNotThrow());
+}
+
+/**
+ * @brief The number of ElemSize elements an access through a scalar pointer
+ * covers: one for a plain element, VF for a vector of them.
+ */
+static uint64_t getAccessedElementCount(Instruction *Access,
+                                        uint64_t ElemSize) {
+  const DataLayout &DL = Access->getModule()->getDataLayout();
+  // stores, masked stores and scatters take the stored value first
+  Type *AccessTy = Access->getType();
+  if (isa<StoreInst>(Access) || AccessTy->isVoidTy())
+    AccessTy = Access->getOperand(0)->getType();
+  if (ElemSize == 0 || isa<ScalableVectorType>(AccessTy))
+    return 1;
+  return divideCeil(DL.getTypeStoreSize(AccessTy).getFixedSize(), ElemSize);
+}
+
+/**
+ * @brief The lowest and highest subscript of the lanes in Lanes that Mask
+ * enables, computed at the current insertion point. No enabled lane gives an
+ * empty range that passes both checks.
+ */
+static std::pair<Value *, Value *>
+createLaneRange(IRBuilder<> &IRB, Value *Lanes, Value *Mask) {
+  Value *LoLanes = Lanes, *HiLanes = Lanes;
+  if (Mask) {
+    auto *VT = cast<VectorType>(Lanes->getType());
+    LoLanes = IRB.CreateSelect(
+        Mask, Lanes, ConstantInt::get(VT, APInt::getSignedMaxValue(64)));
+    HiLanes = IRB.CreateSelect(
+        Mask, Lanes, ConstantInt::get(VT, APInt::getSignedMinValue(64)));
+  }
+  return {IRB.CreateIntrinsic(Intrinsic::vector_reduce_smin,
+                              {Lanes->getType()}, {LoLanes}),
+          IRB.CreateIntrinsic(Intrinsic::vector_reduce_smax,
+                              {Lanes->getType()}, {HiLanes})};
+}
+
 PreservedAnalyses BoundCheckInsertion::run(Function &F,
                                            FunctionAnalysisManager &FAM) {
   if (!isCProgram(F.getParent()) && isCxxSTLFunc(F.getName())) {
@@ -11,31 +134,117 @@ PreservedAnalyses BoundCheckInsertion::run(Function &F,
   LLVMContext &Context = F.getContext();
   Instruction *InsertPoint = F.getEntryBlock().getFirstNonPHI();
   IRBuilder<> IRB(InsertPoint);
-  AttributeList Attr;
-
-  FunctionCallee CheckLower = F.getParent()->getOrInsertFunction(
-      CHECK_LB, Attr, IRB.getVoidTy(), IRB.getInt64Ty(), IRB.getInt64Ty(),
-      IRB.getPtrTy(), IRB.getInt64Ty());
-  FunctionCallee CheckUpper = F.getParent()->getOrInsertFunction(
-      CHECK_UB, Attr, IRB.getVoidTy(), IRB.getInt64Ty(), IRB.getInt64Ty(),
-      IRB.getPtrTy(), IRB.getInt64Ty());
+  FunctionCallee CheckLower = getOrInsertCheck(*F.getParent(), CHECK_LB);
+  FunctionCallee CheckUpper = getOrInsertCheck(*F.getParent(), CHECK_UB);
 
   // TODO: cache the file name
   const auto file = IRB.CreateGlobalStringPtr(
       F.getParent()->getSourceFileName(), SOURCE_FILE_NAME);
 
-  auto createCheckBoundCall = [&](Instruction *point, Value *arraySize,
-                                  Value *subscript) {
-    Value *ln;
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  auto &LVI = FAM.getResult<LazyValueAnalysis>(F);
+  unsigned Skipped = 0;
+  unsigned ReadOnlySkipped = 0;
+
+  auto getLine = [&](Instruction *point) {
     if (const auto Loc = point->getDebugLoc()) {
-      ln = IRB.getInt64(Loc.getLine());
-    } else {
-      ln = IRB.getInt64(0);
+      return IRB.getInt64(Loc.getLine());
     }
+    return IRB.getInt64(0);
+  };
+
+  // whether the upper and the lower check of an access may fail
+  auto getNeededChecks = [&](Instruction *point, Value *arraySize,
+                             Value *lowSubscript, Value *highSubscript) {
+    // zero extended, masked, shifted or modulo subscripts may already be
+    // known to satisfy one of the checks
+    SubscriptExpr HighRange = SubscriptExpr::evaluate(highSubscript);
+    SubscriptExpr LowRange = SubscriptExpr::evaluate(lowSubscript);
+    const auto *ConstSize = dyn_cast<ConstantInt>(arraySize);
+    bool NeedsUpper =
+        !ConstSize || HighRange.Hi > ConstSize->getSExtValue() - 1;
+    bool NeedsLower = !LowRange.isKnownNonNegative();
+
+    // so may subscripts limited by dominating compares
+    if (NeedsUpper) {
+      ConstantRange SubscriptCR =
+          LVI.getConstantRange(highSubscript, point, /*UndefAllowed=*/false);
+      ConstantRange SizeCR =
+          LVI.getConstantRange(arraySize, point, /*UndefAllowed=*/false);
+      NeedsUpper = !SubscriptCR.icmp(CmpInst::ICMP_SLT, SizeCR);
+    }
+    if (NeedsLower) {
+      NeedsLower = !LVI.getConstantRange(lowSubscript, point,
+                                         /*UndefAllowed=*/false)
+                        .isAllNonNegative();
+    }
+    Skipped += !NeedsUpper + !NeedsLower;
+    return std::make_pair(NeedsUpper, NeedsLower);
+  };
+
+  // the lowest subscript is checked against the lower bound and the highest
+  // against the upper one, they are the same for single element accesses
+  auto createCheckBoundCall = [&](Instruction *point, Value *arraySize,
+                                  Value *lowSubscript, Value *highSubscript) {
+    Value *ln = getLine(point);
+    auto [NeedsUpper, NeedsLower] =
+        getNeededChecks(point, arraySize, lowSubscript, highSubscript);
     IRB.SetInsertPoint(point);
-    Value *inclusiveBound = IRB.CreateSub(arraySize, IRB.getInt64(1));
-    IRB.CreateCall(CheckUpper, {inclusiveBound, subscript, file, ln});
-    IRB.CreateCall(CheckLower, {IRB.getInt64(0), subscript, file, ln});
+    if (NeedsUpper) {
+      Value *inclusiveBound = IRB.CreateSub(arraySize, IRB.getInt64(1));
+      IRB.CreateCall(CheckUpper, {inclusiveBound, highSubscript, file, ln});
+    }
+    if (NeedsLower) {
+      IRB.CreateCall(CheckLower, {IRB.getInt64(0), lowSubscript, file, ln});
+    }
+  };
+
+  // the violated flag of each masked site in this function, paired with the
+  // site's record it is written back to
+  SmallVector<std::pair<AllocaInst *, GlobalVariable *>, 8> MaskedSites;
+
+  // INDEX_MASKING: the subscript in SubscriptUse is clamped into the bound, an
+  // unsigned min catches negative subscripts too. A violation is ORed into a
+  // local flag of the site, without any branch. Promoted to a register, the
+  // flag is an OR reduction the loop vectorizer handles.
+  auto createMaskedSubscript = [&](Instruction *point, Use &SubscriptUse,
+                                   Value *arraySize) {
+    Value *subscript = SubscriptUse.get();
+    auto [NeedsUpper, NeedsLower] =
+        getNeededChecks(point, arraySize, subscript, subscript);
+    if (!NeedsUpper && !NeedsLower)
+      return;
+
+    Module &M = *F.getParent();
+    auto *SiteTy =
+        StructType::get(IRB.getInt8Ty(), IRB.getPtrTy(), IRB.getInt64Ty());
+    auto *Site = new GlobalVariable(
+        M, SiteTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+        ConstantStruct::get(SiteTy, {IRB.getInt8(0), file, getLine(point)}),
+        "bound.masked.site");
+    Site->setSection(MASKED_SITES_SECTION);
+    Site->setAlignment(Align(8));
+    appendToCompilerUsed(M, {Site});
+
+    IRB.SetInsertPoint(point);
+    Value *Index = IRB.CreateSExtOrTrunc(subscript, IRB.getInt64Ty());
+    Value *Last = IRB.CreateSub(arraySize, IRB.getInt64(1));
+    const auto *ConstSize = dyn_cast<ConstantInt>(arraySize);
+    Value *Clamped =
+        ConstSize && ConstSize->getValue().isPowerOf2()
+            ? IRB.CreateAnd(Index, Last)
+            : IRB.CreateBinaryIntrinsic(Intrinsic::umin, Index, Last);
+    Value *Violated = IRB.CreateZExt(IRB.CreateICmpUGE(Index, arraySize),
+                                     IRB.getInt8Ty());
+    SubscriptUse.set(IRB.CreateZExtOrTrunc(Clamped, subscript->getType()));
+
+    IRB.SetInsertPoint(&*F.getEntryBlock().getFirstInsertionPt());
+    AllocaInst *Flag = IRB.CreateAlloca(IRB.getInt8Ty(), nullptr, "violated");
+    IRB.CreateStore(IRB.getInt8(0), Flag);
+    IRB.SetInsertPoint(point);
+    Value *Sticky = IRB.CreateLoad(IRB.getInt8Ty(), Flag);
+    IRB.CreateStore(IRB.CreateOr(Sticky, Violated), Flag);
+    MaskedSites.push_back({Flag, Site});
   };
 
   for (auto &BB : F) {
@@ -44,7 +253,7 @@ PreservedAnalyses BoundCheckInsertion::run(Function &F,
       MDNode *MN = I.getMetadata(ACCESS_KEY);
       const auto *GEP = dyn_cast<GetElementPtrInst>(&I);
       if (MN) {
-        // "static array" or "dynamic array"
+        // "static array", "dynamic array" or "parameter array"
         StringRef ArrayType =
             cast<MDString>(MN->getOperand(0).get())->getString();
         // for "static array", "Bound" is a pointer to "ConstantInt"
@@ -53,19 +262,108 @@ PreservedAnalyses BoundCheckInsertion::run(Function &F,
         // Bound to the pointer of subclasses
         Value *Bound =
             cast<ValueAsMetadata>(MN->getOperand(1).get())->getValue();
+        // the address of an element, or the reference operator[] returns
+        if (WRITE_ONLY_CHECKS && !mayWriteThrough(&I)) {
+          ReadOnlySkipped++;
+          continue;
+        }
+        // for "container array", it is the element count and the subscript
+        // is the argument of operator[] or at()
+        if (ArrayType == "container array") {
+          auto *CB = cast<CallBase>(&I);
+          if (INDEX_MASKING) {
+            createMaskedSubscript(&I, CB->getArgOperandUse(1), Bound);
+          } else {
+            Value *subscript = CB->getArgOperand(1);
+            createCheckBoundCall(&I, Bound, subscript, subscript);
+          }
+          continue;
+        }
+        // for "runtime array", it is the base pointer to look the bound up for
+        if (ArrayType == "runtime array") {
+          uint64_t ElemSize =
+              DL.getTypeAllocSize(GEP->getSourceElementType()).getFixedSize();
+          IRB.SetInsertPoint(&I);
+          Bound = IRB.CreateCall(getOrInsertBoundLookup(*F.getParent()),
+                                 {Bound, IRB.getInt64(ElemSize)});
+        }
 
         // llvm::errs() << "Unknown GEP type: ";
         // GEP->print(llvm::errs());
-        Value *subscript = nullptr;
+        unsigned SubscriptOp = 0;
         if (GEP->getSourceElementType()->isArrayTy()) {
-          subscript = GEP->getOperand(GEP->getNumIndices());
+          SubscriptOp = GEP->getNumIndices();
         } else if (GEP->getSourceElementType()->isIntegerTy()) {
-          subscript = GEP->getOperand(1);
+          SubscriptOp = 1;
         } else {
-          subscript = GEP->getOperand(GEP->getNumIndices());
+          SubscriptOp = GEP->getNumIndices();
         }
+        Value *subscript = GEP->getOperand(SubscriptOp);
 
-        createCheckBoundCall(&I, Bound, subscript);
+        // vector accesses cover more than the element the subscript points
+        // to, they are checked over all the lanes they touch
+        uint64_t ElemSize =
+            DL.getTypeAllocSize(GEP->getResultElementType()).getFixedSize();
+        SmallVector<Instruction *, 2> WideAccesses;
+        bool NeedsGEPCheck = false;
+        for (const auto *U : GEP->users()) {
+          auto *Access = const_cast<Instruction *>(cast<Instruction>(U));
+          if (getAccessedPointer(Access) == GEP &&
+              (subscript->getType()->isVectorTy() || getAccessMask(Access) ||
+               getAccessedElementCount(Access, ElemSize) > 1)) {
+            WideAccesses.push_back(Access);
+          } else {
+            NeedsGEPCheck = true;
+          }
+        }
+        NeedsGEPCheck |= WideAccesses.empty();
+
+        if (NeedsGEPCheck && subscript->getType()->isVectorTy()) {
+          // a vector of pointers used other than by a gather or scatter
+          IRB.SetInsertPoint(&I);
+          auto *LaneTy = VectorType::get(
+              IRB.getInt64Ty(), cast<VectorType>(subscript->getType()));
+          auto [Lo, Hi] = createLaneRange(
+              IRB, IRB.CreateSExtOrTrunc(subscript, LaneTy), nullptr);
+          createCheckBoundCall(&I, Bound, Lo, Hi);
+        } else if (NeedsGEPCheck && INDEX_MASKING && WideAccesses.empty() &&
+                   ArrayType != "runtime array" && isOnlyDereferenced(GEP)) {
+          // an unknown bound is looked up as unbounded, nothing to clamp to
+          createMaskedSubscript(&I, I.getOperandUse(SubscriptOp), Bound);
+        } else if (NeedsGEPCheck) {
+          createCheckBoundCall(&I, Bound, subscript, subscript);
+        }
+
+        for (auto *Access : WideAccesses) {
+          IRB.SetInsertPoint(Access);
+          Value *Mask = getAccessMask(Access);
+          Value *Lo, *Hi;
+          if (subscript->getType()->isVectorTy()) {
+            // gathers and scatters touch the enabled lanes of the subscripts
+            auto *LaneTy = VectorType::get(
+                IRB.getInt64Ty(), cast<VectorType>(subscript->getType()));
+            std::tie(Lo, Hi) = createLaneRange(
+                IRB, IRB.CreateSExtOrTrunc(subscript, LaneTy), Mask);
+          } else {
+            uint64_t Count = getAccessedElementCount(Access, ElemSize);
+            auto *MaskTy =
+                Mask ? dyn_cast<FixedVectorType>(Mask->getType()) : nullptr;
+            Value *First = IRB.CreateSExtOrTrunc(subscript, IRB.getInt64Ty());
+            if (MaskTy && MaskTy->getNumElements() == Count) {
+              // masked loads and stores touch consecutive enabled lanes
+              SmallVector<Constant *, 16> Steps;
+              for (uint64_t k = 0; k < Count; k++)
+                Steps.push_back(IRB.getInt64(k));
+              Value *Lanes = IRB.CreateAdd(IRB.CreateVectorSplat(Count, First),
+                                           ConstantVector::get(Steps));
+              std::tie(Lo, Hi) = createLaneRange(IRB, Lanes, Mask);
+            } else {
+              Lo = First;
+              Hi = IRB.CreateAdd(First, IRB.getInt64(Count - 1));
+            }
+          }
+          createCheckBoundCall(Access, Bound, Lo, Hi);
+        }
 
         // FIXME: Not used
         // Value* mallocSizeIfExist = nullptr;
@@ -102,6 +400,33 @@ PreservedAnalyses BoundCheckInsertion::run(Function &F,
     }
   }
 
+  // the sites' records are only written where the function may be left
+  if (!MaskedSites.empty()) {
+    SmallVector<Instruction *, 8> Exits;
+    for (auto &I : instructions(F)) {
+      if (mayLeaveFunction(I))
+        Exits.push_back(&I);
+    }
+    for (auto *Exit : Exits) {
+      IRB.SetInsertPoint(Exit);
+      for (auto [Flag, Site] : MaskedSites) {
+        Value *Violated = IRB.CreateLoad(IRB.getInt8Ty(), Flag);
+        Value *Sticky = IRB.CreateLoad(IRB.getInt8Ty(), Site);
+        IRB.CreateStore(IRB.CreateOr(Sticky, Violated), Site);
+      }
+    }
+  }
+
+  if (GUARD_CHECKS)
+    lowerChecksToGuards(F);
+
+  if (DUMP_STATS && WRITE_ONLY_CHECKS)
+    CountUncheckedAccesses(F, "Write-Only Checks", ReadOnlySkipped);
+
+  VERBOSE_PRINT {
+    llvm::errs() << "Skipped " << Skipped << " provably satisfied checks in "
+                 << F.getName() << "\n";
+  }
 
   // for (auto &BB : F) {
   //   // llvm::errs() << "BB: ";
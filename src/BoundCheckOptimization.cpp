@@ -1,11 +1,17 @@
 #include "BoundCheckOptimization.h"
 #include "BoundPredicate.h"
 #include "BoundPredicateSet.h"
+#include "CheckGuards.h"
 #include "CommonDef.h"
 #include "Effect.h"
 #include "Stats.h"
 #include "SubscriptExpr.h"
+#include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Support/MathExtras.h"
+#include <deque>
 #include <utility>
 
 using namespace llvm;
@@ -120,6 +126,47 @@ Value *createValueForSubExpr(IRBuilder<> &IRB, Instruction *point,
   }
 };
 
+/**
+ * @brief Whether a value computed at From still holds at To for an
+ * expression read from memory: only within a block, with nothing in between
+ * that may store. Check calls only read their arguments.
+ */
+static bool isUnclobberedBetween(Instruction *From, Instruction *To) {
+  if (From->getParent() != To->getParent()) {
+    return false;
+  }
+  for (auto It = std::next(From->getIterator()); &*It != To; ++It) {
+    if (It->mayWriteToMemory() && !isBoundCheckCall(&*It)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Value *MaterializationCache::get(IRBuilder<> &IRB, Instruction *point,
+                                 const SubscriptExpr &SE) {
+  if (SE.isConstant()) {
+    return createValueForSubExpr(IRB, point, SE);
+  }
+  auto &Candidates = Values[SE];
+  erase_if(Candidates, [](const WeakVH &VH) { return !VH; });
+  for (auto &VH : Candidates) {
+    auto *I = cast<Instruction>(VH);
+    if (!DT.dominates(I, point) ||
+        (SE.i->getType()->isPointerTy() && !isUnclobberedBetween(I, point))) {
+      continue;
+    }
+    IRB.SetInsertPoint(point);
+    Reused++;
+    return I;
+  }
+  Value *V = createValueForSubExpr(IRB, point, SE);
+  if (isa<Instruction>(V)) {
+    Candidates.push_back(V);
+  }
+  return V;
+}
+
 /**
  * @brief Create a Check Call object
  *
@@ -446,7 +493,8 @@ void ComputeEffects(Function &F, CMap &Grouped_C_GEN, EffectMap &effects,
 }
 
 void CleanRedundantCheckInSingleBlock(
-    Function &F, ValuePtrVector &ValuesReferencedInBoundCheck) {
+    Function &F, ValuePtrVector &ValuesReferencedInBoundCheck,
+    MaterializationCache &Materialized) {
   LLVMContext &Context = F.getContext();
   IRBuilder<> IRB(Context);
 
@@ -545,9 +593,10 @@ void CleanRedundantCheckInSingleBlock(
                     newBoundValue->print(llvm::errs());
 
                   } else {
-                    newBoundValue =
-                        IRB.CreateAdd(uppermostCheckInst->getArgOperand(0),
-                                      IRB.getInt64(constantDiffOfBound));
+                    newBoundValue = Materialized.get(
+                        IRB, uppermostCheckInst,
+                        {1, uppermostCheckInst->getArgOperand(0),
+                         constantDiffOfBound});
                   }
                   uppermostCheckInst->setArgOperand(0, newBoundValue);
                 }
@@ -619,9 +668,10 @@ void CleanRedundantCheckInSingleBlock(
                     newBoundValue =
                         IRB.getInt64(CI->getSExtValue() + constantDiffOfBound);
                   } else {
-                    newBoundValue =
-                        IRB.CreateAdd(uppermostCheckInst->getArgOperand(0),
-                                      IRB.getInt64(constantDiffOfBound));
+                    newBoundValue = Materialized.get(
+                        IRB, uppermostCheckInst,
+                        {1, uppermostCheckInst->getArgOperand(0),
+                         constantDiffOfBound});
                   }
                   uppermostCheckInst->setArgOperand(0, newBoundValue);
 
@@ -853,7 +903,8 @@ void RunModificationAnalysis(Function &F, CMap &C_IN, CMap &C_OUT, CMap &C_GEN,
 void ApplyModification(Function &F, CMap &Grouped_C_OUT, CMap &C_GEN,
                        ValuePtrVector &ValuesReferencedInSubscript,
                        ValueEvaluationCache &Evaluated, Constant *file,
-                       DominatorTree &DTA) {
+                       DominatorTree &DTA,
+                       MaterializationCache &Materialized) {
 
   VERBOSE_PRINT {
     BLUE(llvm::errs()) << "===================== Apply Modification "
@@ -862,14 +913,9 @@ void ApplyModification(Function &F, CMap &Grouped_C_OUT, CMap &C_GEN,
   LLVMContext &Context = F.getContext();
   Instruction *InsertPoint = F.getEntryBlock().getFirstNonPHI();
   IRBuilder<> IRB(InsertPoint);
-  AttributeList Attr;
-  FunctionCallee CheckLower = F.getParent()->getOrInsertFunction(
-      CHECK_LB, Attr, IRB.getVoidTy(), IRB.getInt64Ty(), IRB.getInt64Ty(),
-      IRB.getPtrTy(), IRB.getInt64Ty());
+  FunctionCallee CheckLower = getOrInsertCheck(*F.getParent(), CHECK_LB);
 
-  FunctionCallee CheckUpper = F.getParent()->getOrInsertFunction(
-      CHECK_UB, Attr, IRB.getVoidTy(), IRB.getInt64Ty(), IRB.getInt64Ty(),
-      IRB.getPtrTy(), IRB.getInt64Ty());
+  FunctionCallee CheckUpper = getOrInsertCheck(*F.getParent(), CHECK_UB);
 
   auto getOrEvaluateSubExpr = [&](Value *V) -> std::pair<SubscriptExpr, bool> {
     if (Evaluated.find(V) != Evaluated.end()) {
@@ -1042,9 +1088,9 @@ void ApplyModification(Function &F, CMap &Grouped_C_OUT, CMap &C_GEN,
               continue;
             }
             Value *bound =
-                createValueForSubExpr(IRB, trailingInsertPoint, UBP.Bound);
+                Materialized.get(IRB, trailingInsertPoint, UBP.Bound);
             Value *subscript =
-                createValueForSubExpr(IRB, trailingInsertPoint, (UBP.Index));
+                Materialized.get(IRB, trailingInsertPoint, (UBP.Index));
             createCheckCall(IRB, trailingInsertPoint, CheckUpper, bound,
                             subscript, file);
           }
@@ -1056,9 +1102,9 @@ void ApplyModification(Function &F, CMap &Grouped_C_OUT, CMap &C_GEN,
               continue;
             }
             Value *bound =
-                createValueForSubExpr(IRB, trailingInsertPoint, LBP.Bound);
+                Materialized.get(IRB, trailingInsertPoint, LBP.Bound);
             Value *subscript =
-                createValueForSubExpr(IRB, trailingInsertPoint, (LBP.Index));
+                Materialized.get(IRB, trailingInsertPoint, (LBP.Index));
             createCheckCall(IRB, trailingInsertPoint, CheckLower, bound,
                             subscript, file);
           }
@@ -1317,6 +1363,128 @@ enum class CandidateKind : unsigned {
   LoopsWithDeltaOne,
 };
 
+/**
+ * @brief The update applied to V on each trip around L, as `V <- A * V + B`.
+ * A header phi is read from its latch incoming value, a variable in memory
+ * from the stores to it inside L.
+ *
+ * @return std::nullopt if V is updated in more than one way
+ */
+std::optional<SubscriptExpr> getLoopRecurrence(Loop *L, const Value *V) {
+  if (auto *Phi = dyn_cast<PHINode>(V)) {
+    BasicBlock *Latch = L->getLoopLatch();
+    if (Phi->getParent() != L->getHeader() || !Latch)
+      return std::nullopt;
+    auto SE = SubscriptExpr::evaluate(Phi->getIncomingValueForBlock(Latch));
+    if (SE.i != Phi)
+      return std::nullopt;
+    return SE;
+  }
+
+  std::optional<SubscriptExpr> Recurrence;
+  for (auto *BB : L->blocks()) {
+    for (auto &Inst : *BB) {
+      auto *SI = dyn_cast<StoreInst>(&Inst);
+      if (!SI || SI->getPointerOperand() != V)
+        continue;
+      auto SE = SubscriptExpr::evaluate(SI->getValueOperand());
+      if (SE.i != V)
+        return std::nullopt;
+      if (SE.A == 1 && SE.B == 0)
+        continue;
+      if (Recurrence && !(*Recurrence == SE))
+        return std::nullopt;
+      Recurrence = SE;
+    }
+  }
+  return Recurrence ? *Recurrence : SubscriptExpr{1, V, 0};
+}
+
+/**
+ * @brief The constant V holds when L is entered from its preheader: the
+ * incoming value of a header phi, or the last write before the loop if it is
+ * a store to V.
+ */
+std::optional<int64_t> getLoopEntryValue(Loop *L, const Value *V) {
+  BasicBlock *Preheader = L->getLoopPreheader();
+  if (!Preheader)
+    return std::nullopt;
+
+  SubscriptExpr SE;
+  if (auto *Phi = dyn_cast<PHINode>(V)) {
+    if (Phi->getParent() != L->getHeader())
+      return std::nullopt;
+    SE = SubscriptExpr::evaluate(Phi->getIncomingValueForBlock(Preheader));
+  } else {
+    const StoreInst *Init = nullptr;
+    for (auto &Inst : reverse(*Preheader)) {
+      // hoisted checks may already sit in the preheader, they write nothing
+      if (!Inst.mayWriteToMemory() || isBoundCheckCall(&Inst))
+        continue;
+      Init = dyn_cast<StoreInst>(&Inst);
+      break;
+    }
+    if (!Init || Init->getPointerOperand() != V)
+      return std::nullopt;
+    SE = SubscriptExpr::evaluate(Init->getValueOperand());
+  }
+
+  if (!SE.isConstant())
+    return std::nullopt;
+  return SE.getConstant();
+}
+
+/**
+ * @brief The last value a loop variable takes before it crosses Limit, when
+ * it starts at Start and follows Recurrence: `Start + k * c` for `i += c` and
+ * `i -= c`, `Start * c^k` for `i *= c`, with k the number of whole strides
+ * that fit.
+ *
+ * @param CountsUp whether Limit is an upper (true) or lower (false) limit
+ * @return std::nullopt on overflow, or if the loop would not be entered
+ */
+std::optional<int64_t> getLastValueInLoop(const SubscriptExpr &Recurrence,
+                                          int64_t Start, int64_t Limit,
+                                          bool CountsUp) {
+  int64_t Distance;
+  if (SubOverflow(Limit, Start, Distance) ||
+      (CountsUp ? Distance < 0 : Distance > 0))
+    return std::nullopt;
+
+  if (Recurrence.A == 1 && Recurrence.B != 0) {
+    int64_t Stride = Recurrence.B;
+    if ((Stride > 0) != CountsUp)
+      return std::nullopt;
+    if (Stride == 1 || Stride == -1)
+      return Limit;
+    // Distance and Stride have the same sign, truncation is floor
+    int64_t Trips = Distance / Stride, Offset, Last;
+    if (MulOverflow(Trips, Stride, Offset) || AddOverflow(Start, Offset, Last))
+      return std::nullopt;
+    return Last;
+  }
+
+  if (Recurrence.A > 1 && Recurrence.B == 0 && CountsUp && Start > 0) {
+    int64_t Last = Start, Next;
+    while (!MulOverflow(Last, Recurrence.A, Next) && Next <= Limit)
+      Last = Next;
+    return Last;
+  }
+
+  return std::nullopt;
+}
+
+// Floor and ceiling of a signed division by a positive divisor
+int64_t divideFloor(int64_t Numerator, int64_t Denominator) {
+  int64_t Quotient = Numerator / Denominator;
+  return Quotient - (Numerator % Denominator < 0 ? 1 : 0);
+}
+
+int64_t divideCeil(int64_t Numerator, int64_t Denominator) {
+  int64_t Quotient = Numerator / Denominator;
+  return Quotient + (Numerator % Denominator > 0 ? 1 : 0);
+}
+
 // Step 1: Identify candidates for propagation
 auto IdentifyCandidatesForPropagation(EffectMap &Effects, Loop *L,
                                       CallInst *CheckCall) -> CandidateKind {
@@ -1336,41 +1504,66 @@ auto IdentifyCandidatesForPropagation(EffectMap &Effects, Loop *L,
   /** ->isLoopInvariant actually return true for a mutated pointer! */
 
   // for (ii)/(iii)/(iv) there must be an effect on i
-  auto EffectsOnDependencyIter = Effects.find(CandidateSE.i);
-  if (EffectsOnDependencyIter == Effects.end()) {
-    return CandidateKind::Invariant;
+  SmallVector<SubscriptExpr, 8> EffectsInLoop;
+  auto *Phi = dyn_cast<PHINode>(CandidateSE.i);
+  if (Phi && Phi->getParent() == L->getHeader()) {
+    // a header phi has no store effects, it changes once per trip
+    auto Recurrence = getLoopRecurrence(L, Phi);
+    if (!Recurrence) {
+      return CandidateKind::NotCandidate;
+    }
+    EffectsInLoop.push_back(*Recurrence);
+  } else {
+    auto EffectsOnDependencyIter = Effects.find(CandidateSE.i);
+    if (EffectsOnDependencyIter == Effects.end()) {
+      return CandidateKind::Invariant;
+    }
+    auto &EffectsOnDependency = EffectsOnDependencyIter->second;
+    for (auto *BB : L->getBlocks()) {
+      EffectsInLoop.append(EffectsOnDependency[BB]);
+    }
   }
 
-  auto &EffectsOnDependency = EffectsOnDependencyIter->second;
   auto FName = CheckCall->getCalledFunction()->getName();
 
   // (iv) check loop with inc/decrement of one first
   // otherwise we fall into (ii)/(iii)
   {
-    if (llvm::all_of(L->getBlocks(), [&](auto *BB) {
-          return llvm::all_of(EffectsOnDependency[BB], [&](auto &SE) {
-            return SE.A == 1 && (SE.B == 1 || SE.B == -1);
-          });
+    if (llvm::all_of(EffectsInLoop, [&](auto &SE) {
+          return SE.A == 1 && (SE.B == 1 || SE.B == -1);
         })) {
       return CandidateKind::LoopsWithDeltaOne;
     }
   }
 
+  // Strictly monotonic strides and geometric progressions: Step 3 can
+  // compute their exact last value, so the check kind does not matter
+  if (auto Recurrence = getLoopRecurrence(L, CandidateSE.i)) {
+    if (Recurrence->A == 1 && Recurrence->B > 0) {
+      return CandidateKind::IncreasingValuesWithLB;
+    }
+    if (Recurrence->A == 1 && Recurrence->B < 0) {
+      return CandidateKind::DecreasingValuesWithUB;
+    }
+    auto Start = getLoopEntryValue(L, CandidateSE.i);
+    if (Recurrence->A > 1 && Recurrence->B == 0 && Start && *Start > 0) {
+      return CandidateKind::IncreasingValuesWithLB;
+    }
+  }
+
   // (ii) Increasing values
   if (FName == CHECK_LB) {
-    if (llvm::all_of(L->getBlocks(), [&](auto *BB) {
-          return llvm::all_of(EffectsOnDependency[BB], [&](auto &SE) {
-            // assert(SE.i == CandidateSE.i);
-            // i <- i + c, i <- c + i
-            if (SE.A == 1 && SE.B >= 0) {
-              return true;
-            }
-            // i <- c * i
-            if (SE.A >= 1 && SE.B == 0) {
-              return true;
-            }
-            return false;
-          });
+    if (llvm::all_of(EffectsInLoop, [&](auto &SE) {
+          // assert(SE.i == CandidateSE.i);
+          // i <- i + c, i <- c + i
+          if (SE.A == 1 && SE.B >= 0) {
+            return true;
+          }
+          // i <- c * i
+          if (SE.A >= 1 && SE.B == 0) {
+            return true;
+          }
+          return false;
         })) {
       return CandidateKind::IncreasingValuesWithLB;
     }
@@ -1379,14 +1572,12 @@ auto IdentifyCandidatesForPropagation(EffectMap &Effects, Loop *L,
   // (iii) Decreasing values
   if (FName == CHECK_UB) {
     bool hasNoneOneDelta = false;
-    if (llvm::all_of(L->getBlocks(), [&](auto *BB) {
-          return llvm::all_of(EffectsOnDependency[BB], [&](auto &SE) {
-            // assert(SE.i == CandidateSE.i);
-            if (SE.A == 1 && SE.B <= 0) {
-              return true;
-            }
-            return false;
-          });
+    if (llvm::all_of(EffectsInLoop, [&](auto &SE) {
+          // assert(SE.i == CandidateSE.i);
+          if (SE.A == 1 && SE.B <= 0) {
+            return true;
+          }
+          return false;
         })) {
       return CandidateKind::DecreasingValuesWithUB;
     }
@@ -1413,7 +1604,7 @@ findAllPossibleInitialValuesAtBB(Value *V, Loop *L, DominatorTree &DT) {
     For the phi value in some benchmark, we travel all to incoming blocks to
     find all possible initial values (or fail)
     */
-    auto PhiV = cast<PHINode>(V);
+    auto PhiV = cast<PHINode>(SE.i);
     for (auto *Incoming : PhiV->blocks()) {
       if (L->contains(cast<BasicBlock>(Incoming))) {
         continue;
@@ -1451,20 +1642,16 @@ findAllPossibleInitialValuesAtBB(Value *V, Loop *L, DominatorTree &DT) {
 void LoopCheckPropagation(Function &F,
                           ValuePtrVector &ValuesReferencedInSubscript,
                           Constant *file, EffectMap &Effects, LoopInfo &LI,
-                          DominatorTree &DT) {
+                          DominatorTree &DT,
+                          MaterializationCache &Materialized) {
   VERBOSE_PRINT {
     BLUE(llvm::errs()) << "===================== Loop Check Propagation "
                           "===================== \n";
   }
 
   IRBuilder<> IRB(F.getEntryBlock().getFirstNonPHI());
-  AttributeList Attr;
-  FunctionCallee CheckLower = F.getParent()->getOrInsertFunction(
-      CHECK_LB, Attr, IRB.getVoidTy(), IRB.getInt64Ty(), IRB.getInt64Ty(),
-      IRB.getPtrTy(), IRB.getInt64Ty());
-  FunctionCallee CheckUpper = F.getParent()->getOrInsertFunction(
-      CHECK_UB, Attr, IRB.getVoidTy(), IRB.getInt64Ty(), IRB.getInt64Ty(),
-      IRB.getPtrTy(), IRB.getInt64Ty());
+  FunctionCallee CheckLower = getOrInsertCheck(*F.getParent(), CHECK_LB);
+  FunctionCallee CheckUpper = getOrInsertCheck(*F.getParent(), CHECK_UB);
 
   for (auto *ValueWeCareAbout : ValuesReferencedInSubscript) {
     VERBOSE_PRINT {
@@ -1630,16 +1817,16 @@ void LoopCheckPropagation(Function &F,
             // hoist checks in prop to n
             // if c \in S, S \in Succ(n) thenelimmatec from S fi
             for (auto &LBP : prop.LbPredicates) {
-              Value *bound = createValueForSubExpr(IRB, InsertPoint, LBP.Bound);
+              Value *bound = Materialized.get(IRB, InsertPoint, LBP.Bound);
               Value *subscript =
-                  createValueForSubExpr(IRB, InsertPoint, LBP.Index);
+                  Materialized.get(IRB, InsertPoint, LBP.Index);
               createCheckCall(IRB, InsertPoint, CheckLower, bound, subscript,
                               file);
             }
             for (auto &UBP : prop.UbPredicates) {
-              Value *bound = createValueForSubExpr(IRB, InsertPoint, UBP.Bound);
+              Value *bound = Materialized.get(IRB, InsertPoint, UBP.Bound);
               Value *subscript =
-                  createValueForSubExpr(IRB, InsertPoint, UBP.Index);
+                  Materialized.get(IRB, InsertPoint, UBP.Index);
               createCheckCall(IRB, InsertPoint, CheckUpper, bound, subscript,
                               file);
             }
@@ -1710,6 +1897,9 @@ void LoopCheckPropagation(Function &F,
           SubscriptExpr HoistedSubscript = CandidateSE;
           SubscriptExpr HoistedBound =
               SubscriptExpr::evaluate(CB->getArgOperand(0));
+          // a container size is reloaded in the loop, it may change there
+          if (!HoistedBound.isConstant() && !L->isLoopInvariant(HoistedBound.i))
+            continue;
 
           VERBOSE_PRINT {
             CB->print(llvm::errs());
@@ -1911,11 +2101,33 @@ void LoopCheckPropagation(Function &F,
               // To hoist the check Predicate {HoistedBound, HoistedSubscript}
 
               // Now we find the bound of ValueWeCareAbout by solving the
-              // equation
-              // FIXME: precision loss
+              // equation. The division rounds towards the inside of the
+              // loop, a symbolic boundary must stay integral, and a negative
+              // factor would flip the comparison.
+              const int64_t Factor = SubscriptExprInBr.A;
+              if (Factor <= 0 || (!BoundaryExprInBr.isConstant() &&
+                                  BoundaryExprInBr.A % Factor != 0))
+                continue;
               BoundaryExprInBr.B -= SubscriptExprInBr.B;
-              BoundaryExprInBr.B /= SubscriptExprInBr.A;
-              BoundaryExprInBr.A /= SubscriptExprInBr.A;
+              BoundaryExprInBr.B = BK == BoundKind::MAX
+                                       ? divideFloor(BoundaryExprInBr.B, Factor)
+                                       : divideCeil(BoundaryExprInBr.B, Factor);
+              if (!BoundaryExprInBr.isConstant())
+                BoundaryExprInBr.A /= Factor;
+
+              // i += c, i -= c and i *= c loops stop short of the boundary,
+              // with a known start their last value is exact
+              if (BoundaryExprInBr.isConstant()) {
+                auto Recurrence = getLoopRecurrence(L, ValueWeCareAbout);
+                auto Start = getLoopEntryValue(L, ValueWeCareAbout);
+                if (Recurrence && Start) {
+                  if (auto Last = getLastValueInLoop(
+                          *Recurrence, *Start, BoundaryExprInBr.getConstant(),
+                          BK == BoundKind::MAX)) {
+                    BoundaryExprInBr = {1, nullptr, *Last};
+                  }
+                }
+              }
 
               // now we have predicate: ValueWeCareAbout <op> BoundaryExprInBr
               // Do the substitution
@@ -1945,6 +2157,17 @@ void LoopCheckPropagation(Function &F,
                 }
               }
 
+              // a header phi is its incoming value on the edge the check is
+              // hoisted to, which is its extreme value for a monotonic loop
+              auto getSubscriptOnEntry = [&](BasicBlock *InsertBB) {
+                auto *Phi = dyn_cast<PHINode>(HoistedSubscript.i);
+                if (!Phi || Phi->getParent() != BlockThatDominatesAllExits)
+                  return HoistedSubscript;
+                return HoistedSubscript.substituted(
+                    {{Phi, SubscriptExpr::evaluate(
+                               Phi->getIncomingValueForBlock(InsertBB))}});
+              };
+
               if ((BK == BoundKind::MAX && FName == CHECK_UB)) {
                 VERBOSE_PRINT {
                   llvm::errs() << "Found a check replacable by max: MAX(";
@@ -1978,9 +2201,8 @@ void LoopCheckPropagation(Function &F,
                       auto *insertPoint = InsertBB->getTerminator();
                       IRB.SetInsertPoint(insertPoint);
                       Value *bound =
-                          createValueForSubExpr(IRB, insertPoint, HoistedBound);
-                      Value *subscript = createValueForSubExpr(
-                          IRB, insertPoint,
+                          Materialized.get(IRB, insertPoint, HoistedBound);
+                      Value *subscript = Materialized.get(IRB, insertPoint,
                           HoistedSubscriptWithMinOrMaxSubstituted);
                       createCheckCall(IRB, insertPoint, CheckUpper, bound,
                                       subscript, file);
@@ -2004,9 +2226,9 @@ void LoopCheckPropagation(Function &F,
                     auto *insertPoint = InsertBB->getTerminator();
                     IRB.SetInsertPoint(insertPoint);
                     Value *bound =
-                        createValueForSubExpr(IRB, insertPoint, HoistedBound);
-                    Value *subscript = createValueForSubExpr(IRB, insertPoint,
-                                                             HoistedSubscript);
+                        Materialized.get(IRB, insertPoint, HoistedBound);
+                    Value *subscript = Materialized.get(
+                        IRB, insertPoint, getSubscriptOnEntry(InsertBB));
                     createCheckCall(IRB, insertPoint, CheckUpper, bound,
                                     subscript, file);
                   }
@@ -2046,9 +2268,8 @@ void LoopCheckPropagation(Function &F,
                       auto *insertPoint = InsertBB->getTerminator();
                       IRB.SetInsertPoint(insertPoint);
                       Value *bound =
-                          createValueForSubExpr(IRB, insertPoint, HoistedBound);
-                      Value *subscript = createValueForSubExpr(
-                          IRB, insertPoint,
+                          Materialized.get(IRB, insertPoint, HoistedBound);
+                      Value *subscript = Materialized.get(IRB, insertPoint,
                           HoistedSubscriptWithMinOrMaxSubstituted);
                       createCheckCall(IRB, insertPoint, CheckLower, bound,
                                       subscript, file);
@@ -2068,9 +2289,9 @@ void LoopCheckPropagation(Function &F,
                     auto *insertPoint = InsertBB->getTerminator();
                     IRB.SetInsertPoint(insertPoint);
                     Value *bound =
-                        createValueForSubExpr(IRB, insertPoint, HoistedBound);
-                    Value *subscript = createValueForSubExpr(IRB, insertPoint,
-                                                             HoistedSubscript);
+                        Materialized.get(IRB, insertPoint, HoistedBound);
+                    Value *subscript = Materialized.get(
+                        IRB, insertPoint, getSubscriptOnEntry(InsertBB));
                     createCheckCall(IRB, insertPoint, CheckLower, bound,
                                     subscript, file);
                   }
@@ -2087,8 +2308,8 @@ void LoopCheckPropagation(Function &F,
                     auto *insertPoint = InsertBB->getTerminator();
                     IRB.SetInsertPoint(insertPoint);
                     Value *bound =
-                        createValueForSubExpr(IRB, insertPoint, HoistedBound);
-                    Value *subscript = createValueForSubExpr(IRB, insertPoint,
+                        Materialized.get(IRB, insertPoint, HoistedBound);
+                    Value *subscript = Materialized.get(IRB, insertPoint,
                                                              HoistedSubscript);
                     createCheckCall(IRB, insertPoint, CheckUpper, bound,
                                     subscript, file);
@@ -2108,8 +2329,8 @@ void LoopCheckPropagation(Function &F,
                     auto *insertPoint = InsertBB->getTerminator();
                     IRB.SetInsertPoint(insertPoint);
                     Value *bound =
-                        createValueForSubExpr(IRB, insertPoint, HoistedBound);
-                    Value *subscript = createValueForSubExpr(IRB, insertPoint,
+                        Materialized.get(IRB, insertPoint, HoistedBound);
+                    Value *subscript = Materialized.get(IRB, insertPoint,
                                                              HoistedSubscript);
                     createCheckCall(IRB, insertPoint, CheckLower, bound,
                                     subscript, file);
@@ -2136,29 +2357,503 @@ void LoopCheckPropagation(Function &F,
   }   // end of value
 };
 
-PreservedAnalyses BoundCheckOptimization::run(Function &F,
-                                              FunctionAnalysisManager &FAM) {
-  if (!isCProgram(F.getParent()) && isCxxSTLFunc(F.getName())) {
-    return PreservedAnalyses::all();
+/**
+ * @brief A call that may free or reallocate an object, and so change what
+ * the bounds table returns for its base.
+ */
+static bool mayChangeBoundsTable(const Instruction &I) {
+  const auto *CB = dyn_cast<CallBase>(&I);
+  if (!CB || isBoundCheckCall(&I) ||
+      (CB->getCalledFunction() &&
+       CB->getCalledFunction()->getName() == BOUND_LOOKUP))
+    return false;
+  return !CB->onlyReadsMemory() && !CB->onlyAccessesInaccessibleMemory();
+}
+
+/**
+ * @brief Merge the bounds table lookups of each base pointer into one call
+ * right after the pointer is defined, so checks on the same base share a
+ * bound the later phases can compare. The table changes in free and realloc:
+ * in a function calling anything that may free, a lookup only moves up in its
+ * block and is only merged with an earlier one up to such a call.
+ */
+void HoistBoundLookups(Function &F) {
+  auto isLookup = [](const Instruction &I) {
+    const auto *CB = dyn_cast<CallInst>(&I);
+    return CB && CB->getCalledFunction() &&
+           CB->getCalledFunction()->getName() == BOUND_LOOKUP;
+  };
+  auto keyOf = [](CallInst *CB) {
+    return std::make_pair(CB->getArgOperand(0), CB->getArgOperand(1));
+  };
+  // an invoke result is only defined on the normal edge, left in place
+  auto isMovable = [](CallInst *CB) {
+    auto *BaseInst = dyn_cast<Instruction>(CB->getArgOperand(0));
+    return !BaseInst || !BaseInst->isTerminator();
+  };
+
+  DenseMap<std::pair<Value *, Value *>, CallInst *> Lookups;
+  // each merged lookup with the one it is replaced by
+  SmallVector<std::pair<CallInst *, CallInst *>, 16> Duplicates;
+
+  if (none_of(instructions(F), mayChangeBoundsTable)) {
+    for (auto &I : instructions(F)) {
+      auto *CB = dyn_cast<CallInst>(&I);
+      if (!isLookup(I) || !isMovable(CB))
+        continue;
+      auto [Iter, Inserted] = Lookups.try_emplace(keyOf(CB), CB);
+      if (!Inserted)
+        Duplicates.push_back({CB, Iter->second});
+    }
+
+    for (auto &[Key, CB] : Lookups) {
+      Value *Base = Key.first;
+      if (auto *BaseInst = dyn_cast<Instruction>(Base)) {
+        if (isa<PHINode>(BaseInst)) {
+          CB->moveBefore(&*BaseInst->getParent()->getFirstInsertionPt());
+        } else {
+          CB->moveAfter(BaseInst);
+        }
+      } else {
+        CB->moveBefore(&*F.getEntryBlock().getFirstInsertionPt());
+      }
+    }
+  } else {
+    for (auto &BB : F) {
+      SmallVector<Instruction *, 32> Insts;
+      for (auto &I : BB)
+        Insts.push_back(&I);
+
+      Instruction *Barrier = nullptr;
+      Lookups.clear();
+      for (auto *I : Insts) {
+        if (mayChangeBoundsTable(*I)) {
+          Barrier = I;
+          Lookups.clear();
+          continue;
+        }
+        auto *CB = dyn_cast<CallInst>(I);
+        if (!isLookup(*I) || !isMovable(CB))
+          continue;
+        auto [Iter, Inserted] = Lookups.try_emplace(keyOf(CB), CB);
+        if (!Inserted) {
+          Duplicates.push_back({CB, Iter->second});
+          continue;
+        }
+        // right after the last call that may free, or the operands
+        Instruction *Pos = Barrier ? Barrier->getNextNode()
+                                   : &*BB.getFirstInsertionPt();
+        for (auto *Op : CB->operand_values()) {
+          auto *OpInst = dyn_cast<Instruction>(Op);
+          if (OpInst && OpInst->getParent() == &BB && !isa<PHINode>(OpInst) &&
+              !OpInst->comesBefore(Pos))
+            Pos = OpInst->getNextNode();
+        }
+        if (Pos != CB)
+          CB->moveBefore(Pos);
+      }
+    }
   }
 
-  llvm::errs() << "BoundCheckOptimization\n";
+  for (auto &[CB, Leader] : Duplicates) {
+    CB->replaceAllUsesWith(Leader);
+    CB->eraseFromParent();
+  }
+}
 
-  auto &Context = F.getContext();
-  auto InsertPoint = F.getEntryBlock().getFirstNonPHI();
-  IRBuilder<> IRB(InsertPoint);
-  auto &DT = FAM.getResult<DominatorTreeAnalysis>(F);
-  auto &LI = FAM.getResult<LoopAnalysis>(F);
-  SourceFileName = F.getParent()->getNamedGlobal(SOURCE_FILE_NAME);
+// how far a check is moved at most, in instructions each way
+constexpr unsigned MAX_PLACEMENT_DISTANCE = 32;
+
+/**
+ * @brief A per block estimate of the values a call would keep live across
+ * itself. A value is live from its definition, or the block entry, to its
+ * last use in the block, or to the end if it is used in another block.
+ * Values live through the whole block are the same everywhere and left out.
+ */
+struct BlockPressure {
+  DenseMap<const Instruction *, unsigned> Index;
+  // the last position a value is used at, -1 for no use in the block
+  DenseMap<const Value *, int> LastUse;
+  // values live across a call inserted before the instruction at each index
+  SmallVector<unsigned, 32> Pressure;
+
+  BlockPressure(BasicBlock &BB, const Instruction *Ignored);
+};
+
+BlockPressure::BlockPressure(BasicBlock &BB, const Instruction *Ignored) {
+  int N = 0;
+  for (auto &I : BB) {
+    Index[&I] = N++;
+  }
+  SmallVector<int, 32> Delta(N + 1, 0);
+  auto addInterval = [&](const Value *V) {
+    if (LastUse.count(V))
+      return;
+    const auto *DefInst = dyn_cast<Instruction>(V);
+    int Def = DefInst && DefInst->getParent() == &BB ? Index[DefInst] : -1;
+    int Last = Def;
+    bool LiveOut = false;
+    for (const auto *U : V->users()) {
+      const auto *UI = dyn_cast<Instruction>(U);
+      if (!UI || UI == Ignored)
+        continue;
+      if (UI->getParent() != &BB || isa<PHINode>(UI)) {
+        LiveOut = true;
+      } else {
+        Last = std::max(Last, (int)Index[UI]);
+      }
+    }
+    if (LiveOut) {
+      Last = N - 1;
+    }
+    LastUse[V] = Last;
+    // a call before position p has the value live across if Def < p <= Last
+    if (Last > Def && !(LiveOut && Def < 0)) {
+      Delta[Def + 1]++;
+      Delta[Last + 1]--;
+    }
+  };
+  for (auto &I : BB) {
+    if (!I.getType()->isVoidTy() && !isa<AllocaInst>(I)) {
+      addInterval(&I);
+    }
+    for (const auto &Op : I.operands()) {
+      if (isa<Argument>(Op) ||
+          (isa<Instruction>(Op) &&
+           cast<Instruction>(Op)->getParent() != &BB)) {
+        addInterval(Op);
+      }
+    }
+  }
+  int Live = 0;
+  for (int p = 0; p < N; p++) {
+    Live += Delta[p];
+    Pressure.push_back(Live);
+  }
+}
+
+/**
+ * @brief Move each check within its block to where the fewest values stay
+ * live across the call, the check's own operands included when the move
+ * extends them. A check never moves above the definition of its operands or
+ * an instruction with side effects, nor below a memory access.
+ */
+void PlaceChecksForPressure(Function &F) {
+  SmallVector<CallInst *, 32> Checks;
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      if (isBoundCheckCall(&I))
+        Checks.push_back(cast<CallInst>(&I));
+    }
+  }
+
+  unsigned Moved = 0;
+  for (auto *CB : Checks) {
+    auto isOperandOf = [CB](const Instruction *I) {
+      return I == CB->getArgOperand(0) || I == CB->getArgOperand(1);
+    };
+    SmallVector<Instruction *, 16> Positions;
+    Instruction *I = CB->getPrevNode();
+    for (unsigned k = 0; I && k < MAX_PLACEMENT_DISTANCE;
+         k++, I = I->getPrevNode()) {
+      if (isa<PHINode>(I) || I->isEHPad() || isOperandOf(I) ||
+          (I->mayHaveSideEffects() && !isBoundCheckCall(I)))
+        break;
+      Positions.push_back(I);
+    }
+    std::reverse(Positions.begin(), Positions.end());
+    Instruction *Current = CB->getNextNode();
+    I = Current;
+    for (unsigned k = 0; k < MAX_PLACEMENT_DISTANCE; k++) {
+      Positions.push_back(I);
+      if (I->isTerminator() ||
+          (I->mayReadOrWriteMemory() && !isBoundCheckCall(I)))
+        break;
+      I = I->getNextNode();
+    }
+    if (Positions.size() < 2)
+      continue;
+
+    BlockPressure BP(*CB->getParent(), CB);
+    auto costAt = [&](Instruction *Pos) {
+      int p = BP.Index[Pos];
+      int Self = BP.Index[CB];
+      unsigned Extension = 0;
+      for (unsigned k = 0; k < 2; k++) {
+        Value *Op = CB->getArgOperand(k);
+        if (isa<Constant>(Op))
+          continue;
+        int Last = BP.LastUse.lookup(Op);
+        if (auto *OpInst = dyn_cast<Instruction>(Op);
+            OpInst && OpInst->getParent() == CB->getParent()) {
+          Last = std::max(Last, (int)BP.Index[OpInst]);
+        }
+        // instructions between the last use and the check, but the check
+        Extension += std::max(0, p - 1 - Last - (Last < Self && Self < p));
+      }
+      return std::make_pair(BP.Pressure[p], Extension);
+    };
+
+    Instruction *Best = Current;
+    auto BestCost = costAt(Current);
+    for (auto *Pos : Positions) {
+      auto Cost = costAt(Pos);
+      if (Cost < BestCost) {
+        Best = Pos;
+        BestCost = Cost;
+      }
+    }
+    if (Best != Current) {
+      CB->moveBefore(Best);
+      Moved++;
+    }
+  }
+
+  VERBOSE_PRINT {
+    llvm::errs() << "Moved " << Moved << " checks to lower pressure points in "
+                 << F.getName() << "\n";
+  }
+}
+
+/**
+ * @brief A check as check-ins left it, before check-opt strengthened, hoisted
+ * or merged it. The handles are nulled when the values are erased.
+ */
+struct OriginalCheck {
+  WeakVH Call;
+  WeakVH Bound;
+  WeakVH Index;
+};
+
+/**
+ * @brief Whether the access a check was inserted for always follows it. That
+ * is the wide load or store check-ins put the check right in front of, or the
+ * GEP it put it in front of when a plain load or store through the GEP is
+ * reached from it without leaving the block. Container calls are left out:
+ * at() throws on a bad subscript, and an address that is only formed, like
+ * `&a[n]`, or only compared is fine out of bounds.
+ */
+static bool precedesAccess(const CallInst *Check) {
+  const Instruction *Point = Check->getNextNode();
+  while (Point && isBoundCheckCall(Point))
+    Point = Point->getNextNode();
+  if (!Point)
+    return false;
+  if (getAccessedPointer(Point))
+    return true;
+  const auto *GEP = dyn_cast<GetElementPtrInst>(Point);
+  if (!GEP || GEP->getType()->isVectorTy())
+    return false;
+  for (const auto *U : GEP->users()) {
+    const auto *Access = cast<Instruction>(U);
+    if (getAccessedPointer(Access) != GEP || getAccessMask(Access) ||
+        Access->getParent() != GEP->getParent())
+      continue;
+    if (isGuaranteedToTransferExecutionToSuccessor(GEP->getIterator(),
+                                                   Access->getIterator()))
+      return true;
+  }
+  return false;
+}
+
+static SmallVector<OriginalCheck, 32> collectOriginalChecks(Function &F) {
+  SmallVector<OriginalCheck, 32> Checks;
+  for (auto &I : instructions(F)) {
+    if (!isBoundCheckCall(&I) || !precedesAccess(cast<CallInst>(&I)))
+      continue;
+    auto *CB = cast<CallInst>(&I);
+    Checks.push_back({CB, CB->getArgOperand(0), CB->getArgOperand(1)});
+  }
+  return Checks;
+}
+
+/**
+ * @brief Follow each check still in the place and form check-ins gave it
+ * with an llvm.assume of its predicate, `idx <= bound` after an upper bound
+ * check and `bound <= idx` after a lower bound one. Only checks followed by
+ * their access are collected, see precedesAccess(), which would be undefined
+ * if the check failed, so the assumption adds nothing the program did not
+ * promise. Modified and hoisted checks test a stronger
+ * predicate, the loop may exit before it matters, so they get none.
+ */
+void AssumeCheckedBounds(ArrayRef<OriginalCheck> Checks) {
+  for (const auto &Check : Checks) {
+    auto *CB = cast_or_null<CallInst>(static_cast<Value *>(Check.Call));
+    if (!CB || CB->getArgOperand(0) != Check.Bound ||
+        CB->getArgOperand(1) != Check.Index)
+      continue;
+    // already followed by its assumption in an earlier run
+    auto *Cmp = dyn_cast<ICmpInst>(CB->getNextNode());
+    if (Cmp && Cmp->hasOneUse() && isa<AssumeInst>(Cmp->user_back()))
+      continue;
+    IRBuilder<> IRB(CB->getNextNode());
+    Value *Bound = CB->getArgOperand(0);
+    Value *Index = CB->getArgOperand(1);
+    Value *Holds = CB->getCalledFunction()->getName() == CHECK_UB
+                       ? IRB.CreateICmpSLE(Index, Bound)
+                       : IRB.CreateICmpSLE(Bound, Index);
+    if (!isa<Constant>(Holds))
+      IRB.CreateAssumption(Holds);
+  }
+}
+
+/**
+ * @brief A check available on entry to the current dominator tree node, with
+ * a link to the previous check on the same index in an enclosing scope.
+ */
+struct AvailableCheck {
+  BoundPredicate Predicate;
+  const AvailableCheck *Outer;
+};
+
+using AvailableCheckTable =
+    ScopedHashTable<SubscriptIndentity, const AvailableCheck *>;
+
+// Only SSA values are stable between two checks, a variable in memory may be
+// stored to in between
+static bool isSSAExpr(const SubscriptExpr &SE) {
+  return SE.isConstant() || !SE.i->getType()->isPointerTy();
+}
+
+// subsumes() is only defined between bounds of the same shape
+static bool haveComparableBounds(const BoundPredicate &P,
+                                 const BoundPredicate &Q) {
+  if (P.index() != Q.index())
+    return false;
+  const auto &X = std::visit(
+      [](const auto &Pred) -> const SubscriptExpr & { return Pred.Bound; }, P);
+  const auto &Y = std::visit(
+      [](const auto &Pred) -> const SubscriptExpr & { return Pred.Bound; }, Q);
+  if (X.isConstant() || Y.isConstant())
+    return X.isConstant() && Y.isConstant();
+  return X.i == Y.i && X.A == Y.A;
+}
+
+/**
+ * @brief Remove every check dominated by an equal or stronger check on the
+ * same index, with one DFS over the dominator tree. This is the linear time
+ * alternative to the dataflow analyses for huge functions: it neither
+ * modifies nor propagates checks.
+ */
+void EliminateDominatedChecks(Function &F, DominatorTree &DT) {
+  AvailableCheckTable Available;
+  std::deque<AvailableCheck> Nodes;
+  SmallVector<CallInst *, 32> RedundantChecks;
+
+  auto VisitBlock = [&](BasicBlock *BB) {
+    for (auto &I : *BB) {
+      if (!isBoundCheckCall(&I))
+        continue;
+      auto *CB = cast<CallInst>(&I);
+      SubscriptExpr Bound = SubscriptExpr::evaluate(CB->getArgOperand(0));
+      SubscriptExpr Index = SubscriptExpr::evaluate(CB->getArgOperand(1));
+      if (!isSSAExpr(Bound) || !isSSAExpr(Index))
+        continue;
+
+      BoundPredicate Predicate =
+          CB->getCalledFunction()->getName() == CHECK_LB
+              ? BoundPredicate{LowerBoundPredicate{Bound, Index}}
+              : BoundPredicate{UpperBoundPredicate{Bound, Index}};
+      auto Key = Index.getIdentity();
+
+      const AvailableCheck *Innermost = Available.lookup(Key);
+      bool Redundant = false;
+      for (const auto *A = Innermost; A && !Redundant; A = A->Outer) {
+        Redundant = haveComparableBounds(A->Predicate, Predicate) &&
+                    std::visit(
+                        [](const auto &Dominating, const auto &Dominated) {
+                          return Dominating.subsumes(Dominated);
+                        },
+                        A->Predicate, Predicate);
+      }
+      if (Redundant) {
+        RedundantChecks.push_back(CB);
+        continue;
+      }
+
+      Nodes.push_back({Predicate, Innermost});
+      Available.insert(Key, &Nodes.back());
+    }
+  };
+
+  // iterative DFS, generated code can have very deep dominator trees
+  struct StackNode {
+    DomTreeNode *Node;
+    DomTreeNode::iterator NextChild;
+    std::unique_ptr<AvailableCheckTable::ScopeTy> Scope;
+  };
+  SmallVector<StackNode, 32> Stack;
+  auto Enter = [&](DomTreeNode *Node) {
+    Stack.push_back({Node, Node->begin(),
+                     std::make_unique<AvailableCheckTable::ScopeTy>(Available)});
+    VisitBlock(Node->getBlock());
+  };
+
+  Enter(DT.getRootNode());
+  while (!Stack.empty()) {
+    auto &Top = Stack.back();
+    if (Top.NextChild == Top.Node->end()) {
+      Stack.pop_back();
+      continue;
+    }
+    Enter(*Top.NextChild++);
+  }
+
+  for (auto *CB : RedundantChecks) {
+    Value *Bound = CB->getArgOperand(0);
+    Value *Index = CB->getArgOperand(1);
+    CB->eraseFromParent();
+    RecursivelyClearAllInstructionsUsedOnlyBy(Bound);
+    RecursivelyClearAllInstructionsUsedOnlyBy(Index);
+  }
+
+  VERBOSE_PRINT {
+    llvm::errs() << "Dominator tree walk removed " << RedundantChecks.size()
+                 << " check(s) in " << F.getName() << "\n";
+  }
+}
+
+using CheckSignature =
+    SmallVector<std::tuple<const BasicBlock *, bool, SubscriptExpr,
+                           SubscriptExpr>,
+                64>;
+
+/**
+ * @brief Summarize the checks of F by block, kind, bound and index. A round
+ * that leaves the signature unchanged has reached the fixpoint.
+ */
+static CheckSignature computeCheckSignature(Function &F) {
+  CheckSignature Signature;
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      if (!isBoundCheckCall(&I))
+        continue;
+      auto *CB = cast<CallInst>(&I);
+      Signature.emplace_back(&BB,
+                             CB->getCalledFunction()->getName() == CHECK_LB,
+                             SubscriptExpr::evaluate(CB->getArgOperand(0)),
+                             SubscriptExpr::evaluate(CB->getArgOperand(1)));
+    }
+  }
+  return Signature;
+}
+
+void BoundCheckOptimization::runRound(Function &F, DominatorTree &DT,
+                                      LoopInfo &LI, unsigned Round) {
+  // the first round keeps the table names the stats scripts know
+  auto StageName = [Round](const char *Name) {
+    std::string Label = Name;
+    if (Round > 1)
+      Label += " (round " + std::to_string(Round) + ")";
+    return Label;
+  };
 
   CMap C_GEN{};
   EffectMap Effects{};
   ValueEvaluationCache Evaluated{};
   ValuePtrVector ValuesReferencedInSubscript = {};
   ValuePtrVector ValuesReferencedInBound = {};
-
-  if (DUMP_STATS)
-    CountBountCheck(F, "After Insertion");
+  MaterializationCache Materialized(DT);
 
   /** Compute C_GEN, Effects, ValuesReferencedInSubscript,
    * ValuesReferencedInBound */
@@ -2176,14 +2871,15 @@ PreservedAnalyses BoundCheckOptimization::run(Function &F,
                             ValuesReferencedInSubscript);
 
     ApplyModification(F, C_OUT, C_GEN, ValuesReferencedInSubscript, Evaluated,
-                      SourceFileName, DT);
+                      SourceFileName, DT, Materialized);
   }
 
   if (DUMP_STATS)
-    CountBountCheck(F, "After Modification");
+    CountBountCheck(F, StageName("After Modification").c_str());
 
   if (CLEAN_REDUNDANT_CHECK_IN_SAME_BB)
-    CleanRedundantCheckInSingleBlock(F, ValuesReferencedInSubscript);
+    CleanRedundantCheckInSingleBlock(F, ValuesReferencedInSubscript,
+                                     Materialized);
 
   /** Update C_GEN */
   {
@@ -2205,15 +2901,91 @@ PreservedAnalyses BoundCheckOptimization::run(Function &F,
   }
 
   if (DUMP_STATS)
-    CountBountCheck(F, "After Elimination");
+    CountBountCheck(F, StageName("After Elimination").c_str());
 
   if (LOOP_PROPAGATION) {
     LoopCheckPropagation(F, ValuesReferencedInSubscript, SourceFileName,
-                         Effects, LI, DT);
+                         Effects, LI, DT, Materialized);
+  }
+
+  if (DUMP_STATS)
+    CountBountCheck(F, StageName("After Loop Propagation").c_str());
+
+  VERBOSE_PRINT {
+    llvm::errs() << "Reused " << Materialized.Reused
+                 << " materialized bound and index values\n";
+  }
+}
+
+/**
+ * @brief The last steps on the checks that are kept: assumptions of what the
+ * original checks checked, at their own position, placement, then guards.
+ */
+static void finishChecks(Function &F, bool AsGuards,
+                         ArrayRef<OriginalCheck> OriginalChecks) {
+  // a patchable check may be off, then nothing backs the assumption
+  if (!AsGuards && ASSUME_CHECKED_BOUNDS && !PATCHABLE_CHECKS)
+    AssumeCheckedBounds(OriginalChecks);
+  if (PRESSURE_AWARE_PLACEMENT)
+    PlaceChecksForPressure(F);
+  if (AsGuards)
+    lowerChecksToGuards(F);
+}
+
+PreservedAnalyses BoundCheckOptimization::run(Function &F,
+                                              FunctionAnalysisManager &FAM) {
+  if (!isCProgram(F.getParent()) && isCxxSTLFunc(F.getName())) {
+    return PreservedAnalyses::all();
+  }
+
+  llvm::errs() << "BoundCheckOptimization\n";
+
+  auto &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+  auto &LI = FAM.getResult<LoopAnalysis>(F);
+  SourceFileName = F.getParent()->getNamedGlobal(SOURCE_FILE_NAME);
+
+  // checks that come in as guards are optimized as calls and leave as guards
+  bool AsGuards = liftGuardsToChecks(F) > 0 || GUARD_CHECKS;
+
+  if (DUMP_STATS)
+    CountBountCheck(F, "After Insertion");
+  SmallVector<OriginalCheck, 32> OriginalChecks = collectOriginalChecks(F);
+
+  // lookups are only there if check-ins used the RUNTIME_BOUNDS_TABLE
+  HoistBoundLookups(F);
+
+  if (F.size() > FAST_ELIMINATION_BLOCK_THRESHOLD ||
+      hasFunctionAnnotation(F, FAST_ELIMINATION_ANNOTATION)) {
+    EliminateDominatedChecks(F, DT);
+    if (DUMP_STATS)
+      CountBountCheck(F, "After Fast Elimination");
+    finishChecks(F, AsGuards, OriginalChecks);
+    return PreservedAnalyses::none();
+  }
+
+  // Checks hoisted into a preheader can be eliminated against the checks
+  // that dominate them, so the phases are repeated until nothing moves.
+  // Only calls are inserted and erased, the CFG analyses stay valid.
+  CheckSignature Signature = computeCheckSignature(F);
+  unsigned Round = 1;
+  for (; Round <= MAX_OPTIMIZATION_ROUNDS; Round++) {
+    runRound(F, DT, LI, Round);
+    CheckSignature NewSignature = computeCheckSignature(F);
+    if (NewSignature == Signature)
+      break;
+    Signature = std::move(NewSignature);
+  }
+
+  VERBOSE_PRINT {
+    llvm::errs() << "Optimization of " << F.getName() << " stopped after "
+                 << std::min(Round, (unsigned)MAX_OPTIMIZATION_ROUNDS)
+                 << " round(s)\n";
   }
 
   if (DUMP_STATS)
-    CountBountCheck(F, "After Loop Propagation");
+    CountBountCheck(F, "After Fixpoint");
+
+  finishChecks(F, AsGuards, OriginalChecks);
 
   // F.viewCFG();
 
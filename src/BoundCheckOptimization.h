@@ -1,13 +1,23 @@
 #ifndef BOUND_CHECK_OPTIMIZATION_H
 #define BOUND_CHECK_OPTIMIZATION_H
 
+#include "SubscriptExpr.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/ValueHandle.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include <unordered_map>
 
 class BoundCheckOptimization
     : public llvm::PassInfoMixin<BoundCheckOptimization> {
   llvm::Constant *SourceFileName;
 
+  // modification, cleanup, elimination and loop propagation, once
+  void runRound(llvm::Function &F, llvm::DominatorTree &DT, llvm::LoopInfo &LI,
+                unsigned Round);
+
 public:
   llvm::PreservedAnalyses run(llvm::Function &F,
                               llvm::FunctionAnalysisManager &FAM);
@@ -15,4 +25,35 @@ public:
   virtual ~BoundCheckOptimization();
 };
 
-#endif // BOUND_CHECK_OPTIMIZATION_H
\ No newline at end of file
+// Helpers shared with the other check transformations
+
+void RecursivelyClearAllInstructionsUsedOnlyBy(llvm::Value *V);
+
+llvm::Value *createValueForSubExpr(llvm::IRBuilder<> &IRB,
+                                   llvm::Instruction *point,
+                                   const SubscriptExpr &SE);
+
+/**
+ * @brief Values created for subscript expressions, reused at the insertion
+ * points they dominate instead of being rebuilt there. Checks erased later
+ * may take their values with them, so they are held by weak handles.
+ */
+class MaterializationCache {
+  llvm::DominatorTree &DT;
+  std::unordered_map<SubscriptExpr, llvm::SmallVector<llvm::WeakVH, 2>> Values;
+
+public:
+  explicit MaterializationCache(llvm::DominatorTree &DT) : DT(DT) {}
+
+  llvm::Value *get(llvm::IRBuilder<> &IRB, llvm::Instruction *point,
+                   const SubscriptExpr &SE);
+
+  unsigned Reused = 0;
+};
+
+llvm::CallInst *createCheckCall(llvm::IRBuilder<> &IRB,
+                                llvm::Instruction *point,
+                                llvm::FunctionCallee Check, llvm::Value *bound,
+                                llvm::Value *subscript, llvm::Constant *file);
+
+#endif // BOUND_CHECK_OPTIMIZATION_H
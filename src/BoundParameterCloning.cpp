@@ -0,0 +1,294 @@
+#include "BoundParameterCloning.h"
+#include "CommonDef.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+
+// an element count nobody can exceed, for pointers of unknown size
+constexpr int64_t UNKNOWN_COUNT = INT64_MAX;
+
+static Value *traceToObject(Value *V, unsigned Depth = 0);
+
+/**
+ * @brief The object a stack slot holds a pointer to. -O0 code spills
+ * pointers to a slot, which is followed as long as every store to it stores
+ * the same object and its address does not escape.
+ *
+ * @return nullptr if the slot may point to several objects
+ */
+static Value *getSlotObject(AllocaInst *Slot, unsigned Depth) {
+  Value *Object = nullptr;
+  for (auto *U : Slot->users()) {
+    if (isa<LoadInst>(U))
+      continue;
+    auto *SI = dyn_cast<StoreInst>(U);
+    if (!SI || SI->getPointerOperand() != Slot) {
+      return nullptr;
+    }
+    Value *Stored = traceToObject(SI->getValueOperand(), Depth + 1);
+    if (!Stored || (Object && Object != Stored)) {
+      return nullptr;
+    }
+    Object = Stored;
+  }
+  return Object;
+}
+
+/**
+ * @brief Trace a pointer back to the object it points to the start of.
+ */
+static Value *traceToObject(Value *V, unsigned Depth) {
+  V = stripZeroOffsets(V);
+  auto *LI = dyn_cast<LoadInst>(V);
+  if (!LI) {
+    return V;
+  }
+  auto *Slot = dyn_cast<AllocaInst>(LI->getPointerOperand());
+  if (!Slot || Depth > 4) {
+    return nullptr;
+  }
+  return getSlotObject(Slot, Depth);
+}
+
+/**
+ * @brief The element type a pointer parameter is indexed with, directly,
+ * through the stack slot it is spilled to, or by the callees it is passed to.
+ *
+ * @return nullptr if the parameter is not indexed, or with several types
+ */
+static Type *getIndexedElementType(Argument &Arg, unsigned Depth = 0) {
+  if (!Arg.getType()->isPointerTy() || Depth > 2) {
+    return nullptr;
+  }
+  Type *ElementTy = nullptr;
+  auto addElementType = [&](Type *Ty) {
+    if (Ty->isArrayTy() || Ty->isVectorTy() || (ElementTy && ElementTy != Ty))
+      return false;
+    ElementTy = Ty;
+    return true;
+  };
+
+  SmallVector<Value *, 8> Worklist{&Arg};
+  while (!Worklist.empty()) {
+    Value *V = Worklist.pop_back_val();
+    for (auto *U : V->users()) {
+      if (auto *GI = dyn_cast<GetElementPtrInst>(U)) {
+        if (GI->getPointerOperand() != V)
+          continue;
+        if (!addElementType(GI->getSourceElementType()))
+          return nullptr;
+      } else if (auto *Call = dyn_cast<CallInst>(U)) {
+        Function *Callee = Call->getCalledFunction();
+        if (!Callee || Callee->isDeclaration() || Callee->isVarArg() ||
+            Callee->getFunctionType() != Call->getFunctionType())
+          continue;
+        for (auto &Param : Callee->args()) {
+          if (Call->getArgOperand(Param.getArgNo()) != V)
+            continue;
+          Type *Ty = getIndexedElementType(Param, Depth + 1);
+          if (Ty && !addElementType(Ty))
+            return nullptr;
+        }
+      } else if (auto *SI = dyn_cast<StoreInst>(U)) {
+        auto *Slot = dyn_cast<AllocaInst>(SI->getPointerOperand());
+        if (V != &Arg || SI->getValueOperand() != V || !Slot ||
+            getSlotObject(Slot, 0) != &Arg) {
+          continue;
+        }
+        for (auto *SlotUser : Slot->users()) {
+          if (isa<LoadInst>(SlotUser))
+            Worklist.push_back(SlotUser);
+        }
+      }
+    }
+  }
+  return ElementTy;
+}
+
+Function *BoundParameterCloning::getOrCreateBoundedClone(Function &F) {
+  auto Iter = BoundedClones.find(&F);
+  if (Iter != BoundedClones.end()) {
+    return Iter->second;
+  }
+  BoundedClones[&F] = nullptr;
+
+  if (F.isDeclaration() || F.isVarArg() || F.getName() == "main" ||
+      (!isCProgram(F.getParent()) && isCxxSTLFunc(F.getName()))) {
+    return nullptr;
+  }
+
+  SmallVector<unsigned, 4> IndexedParams;
+  for (auto &Arg : F.args()) {
+    if (getIndexedElementType(Arg)) {
+      IndexedParams.push_back(Arg.getArgNo());
+    }
+  }
+  if (IndexedParams.empty()) {
+    return nullptr;
+  }
+
+  LLVMContext &Context = F.getContext();
+  SmallVector<Type *, 8> Params(F.getFunctionType()->param_begin(),
+                                F.getFunctionType()->param_end());
+  Params.append(IndexedParams.size(), Type::getInt64Ty(Context));
+  auto *FT = FunctionType::get(F.getReturnType(), Params, false);
+  Function *Clone =
+      Function::Create(FT, GlobalValue::InternalLinkage, F.getAddressSpace(),
+                       F.getName() + ".bounded", F.getParent());
+
+  ValueToValueMapTy VMap;
+  for (auto &Arg : F.args()) {
+    Argument *NewArg = Clone->getArg(Arg.getArgNo());
+    NewArg->setName(Arg.getName());
+    VMap[&Arg] = NewArg;
+  }
+  SmallVector<ReturnInst *, 4> Returns;
+  CloneFunctionInto(Clone, &F, VMap, CloneFunctionChangeType::LocalChangesOnly,
+                    Returns);
+  Clone->setLinkage(GlobalValue::InternalLinkage);
+  Clone->setVisibility(GlobalValue::DefaultVisibility);
+  Clone->setComdat(nullptr);
+
+  for (unsigned k = 0; k < IndexedParams.size(); k++) {
+    Argument *Array = Clone->getArg(IndexedParams[k]);
+    Argument *Count = Clone->getArg(F.arg_size() + k);
+    Count->setName(Array->getName() + ".count");
+    Array->addAttr(Attribute::get(Context, ARRAY_BOUND_ATTR,
+                                  utostr(Count->getArgNo())));
+  }
+
+  VERBOSE_PRINT {
+    llvm::errs() << "Cloned " << F.getName() << " with "
+                 << IndexedParams.size() << " bound parameter(s)\n";
+  }
+
+  BoundedClones[&F] = Clone;
+  // a clone is never cloned again
+  BoundedClones[Clone] = nullptr;
+  NewClones.push_back(Clone);
+  return Clone;
+}
+
+/**
+ * @brief The number of ElementTy elements in the object Root, computed at
+ * Call: globals have a constant size, allocas and heap allocations take it
+ * from their size operands, and a bounded clone forwards its own count.
+ */
+Value *BoundParameterCloning::getElementCount(Value *Root, Type *ElementTy,
+                                              CallInst *Call,
+                                              DominatorTree &DT) {
+  const DataLayout &DL = Call->getModule()->getDataLayout();
+  uint64_t ElemSize = DL.getTypeAllocSize(ElementTy).getFixedSize();
+  if (!Root || ElemSize == 0) {
+    return nullptr;
+  }
+  IRBuilder<> IRB(Call);
+
+  if (auto *GV = dyn_cast<GlobalVariable>(Root)) {
+    if (!GV->hasDefinitiveInitializer()) {
+      return nullptr;
+    }
+    uint64_t Bytes = DL.getTypeAllocSize(GV->getValueType()).getFixedSize();
+    return IRB.getInt64(Bytes / ElemSize);
+  }
+
+  if (auto *Arg = dyn_cast<Argument>(Root)) {
+    Argument *Count = getArrayBoundArgument(*Arg);
+    if (!Count || getIndexedElementType(*Arg) != ElementTy) {
+      return nullptr;
+    }
+    return Count;
+  }
+
+  // allocas and heap allocations, whose size operands must be available here
+  auto *Allocation = dyn_cast<Instruction>(Root);
+  if (!Allocation || !DT.dominates(Allocation, Call)) {
+    return nullptr;
+  }
+  return getAllocationElementCount(IRB, Allocation, ElemSize);
+}
+
+bool BoundParameterCloning::rewriteCallSites(Function &F, DominatorTree &DT) {
+  SmallVector<CallInst *, 16> Calls;
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      auto *Call = dyn_cast<CallInst>(&I);
+      if (Call && Call->getCalledFunction() &&
+          Call->getCalledFunction()->getFunctionType() ==
+              Call->getFunctionType()) {
+        Calls.push_back(Call);
+      }
+    }
+  }
+
+  unsigned Rewritten = 0;
+  for (auto *Call : Calls) {
+    Function *Callee = Call->getCalledFunction();
+    Function *Clone = getOrCreateBoundedClone(*Callee);
+    if (!Clone)
+      continue;
+
+    SmallVector<Value *, 8> Args(Call->args());
+    bool KnowsAnySize = false;
+    for (auto &Arg : Callee->args()) {
+      Type *ElementTy = getIndexedElementType(Arg);
+      if (!ElementTy)
+        continue;
+      Value *Root = traceToObject(Call->getArgOperand(Arg.getArgNo()));
+      Value *Count = getElementCount(Root, ElementTy, Call, DT);
+      KnowsAnySize |= Count != nullptr;
+      Args.push_back(Count ? Count
+                           : ConstantInt::get(Type::getInt64Ty(F.getContext()),
+                                              UNKNOWN_COUNT));
+    }
+    if (!KnowsAnySize)
+      continue;
+
+    auto *NewCall = CallInst::Create(Clone, Args, "", Call);
+    NewCall->takeName(Call);
+    NewCall->setCallingConv(Call->getCallingConv());
+    NewCall->setAttributes(Call->getAttributes());
+    NewCall->setTailCallKind(Call->getTailCallKind());
+    NewCall->setDebugLoc(Call->getDebugLoc());
+    Call->replaceAllUsesWith(NewCall);
+    Call->eraseFromParent();
+    Rewritten++;
+  }
+
+  VERBOSE_PRINT {
+    if (Rewritten) {
+      llvm::errs() << "Passed bounds at " << Rewritten << " call(s) in "
+                   << F.getName() << "\n";
+    }
+  }
+  return Rewritten != 0;
+}
+
+PreservedAnalyses BoundParameterCloning::run(Module &M,
+                                             ModuleAnalysisManager &MAM) {
+  auto &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  SmallVector<Function *, 16> Worklist;
+  for (auto &F : M) {
+    if (!F.isDeclaration())
+      Worklist.push_back(&F);
+  }
+
+  // clones are rewritten in turn, so counts flow down call chains
+  bool Changed = false;
+  for (size_t k = 0; k < Worklist.size(); k++) {
+    Function *F = Worklist[k];
+    auto &DT = FAM.getResult<DominatorTreeAnalysis>(*F);
+    if (rewriteCallSites(*F, DT)) {
+      FAM.invalidate(*F, PreservedAnalyses::none());
+      Changed = true;
+    }
+    Worklist.append(NewClones);
+    NewClones.clear();
+  }
+  return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
+
+BoundParameterCloning::~BoundParameterCloning() {}
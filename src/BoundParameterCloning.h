@@ -0,0 +1,34 @@
+#ifndef BOUND_PARAMETER_CLONING_H
+#define BOUND_PARAMETER_CLONING_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+/**
+ * @brief Clone functions indexing pointer parameters into variants taking the
+ * element count of each such parameter, and call them from the call sites
+ * that know the size of the allocation they pass. access-det then finds a
+ * bound for the accesses in the clone.
+ */
+class BoundParameterCloning
+    : public llvm::PassInfoMixin<BoundParameterCloning> {
+  // original function -> clone with the extra count parameters
+  llvm::DenseMap<llvm::Function *, llvm::Function *> BoundedClones;
+  // clones whose own call sites are not rewritten yet
+  llvm::SmallVector<llvm::Function *, 8> NewClones;
+
+  llvm::Function *getOrCreateBoundedClone(llvm::Function &F);
+  llvm::Value *getElementCount(llvm::Value *Root, llvm::Type *ElementTy,
+                               llvm::CallInst *Call, llvm::DominatorTree &DT);
+  bool rewriteCallSites(llvm::Function &F, llvm::DominatorTree &DT);
+
+public:
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+  static bool isRequired() { return true; }
+  virtual ~BoundParameterCloning();
+};
+
+#endif // BOUND_PARAMETER_CLONING_H
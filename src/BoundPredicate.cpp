@@ -13,8 +13,8 @@ bool BoundPredicateIdentity::operator==(
 }
 
 void BoundPredicateBase::normalize() {
-  Bound.B -= Index.B;
-  Index.B = 0;
+  Bound.mutatingSub(Index.B);
+  Index.mutatingSub(Index.B);
 }
 
 bool BoundPredicateBase::isNormalized() const { return Index.B == 0; }
@@ -0,0 +1,143 @@
+#include "CheckGuards.h"
+#include "CommonDef.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+using namespace llvm;
+
+// metadata on the compare of a guard, the kind of check it stands for
+constexpr auto GUARD_CHECK_KEY = "bound-check";
+
+/**
+ * @brief Replace every check of F by a guard on its predicate, tagged so
+ * that liftGuardsToChecks() can tell the bound from the index again. The
+ * deopt arguments are the file and line the check would have reported.
+ *
+ * @return the number of checks replaced
+ */
+unsigned lowerChecksToGuards(Function &F) {
+  Module &M = *F.getParent();
+  LLVMContext &Context = F.getContext();
+  Function *Guard = Intrinsic::getDeclaration(&M, Intrinsic::experimental_guard);
+  IRBuilder<> IRB(Context);
+  unsigned Lowered = 0;
+  for (auto &BB : F) {
+    for (auto &I : make_early_inc_range(BB)) {
+      if (!isBoundCheckCall(&I))
+        continue;
+      auto *CB = cast<CallInst>(&I);
+      bool IsUpper = CB->getCalledFunction()->getName() == CHECK_UB;
+      Value *Bound = CB->getArgOperand(0);
+      Value *Index = CB->getArgOperand(1);
+      IRB.SetInsertPoint(CB);
+      Value *Holds = IsUpper ? IRB.CreateICmpSLE(Index, Bound)
+                             : IRB.CreateICmpSLE(Bound, Index);
+      if (auto *Cmp = dyn_cast<ICmpInst>(Holds)) {
+        Cmp->setMetadata(GUARD_CHECK_KEY,
+                         MDNode::get(Context, MDString::get(
+                                                  Context, IsUpper ? "upper"
+                                                                   : "lower")));
+      }
+      if (!isa<Constant>(Holds) || !cast<Constant>(Holds)->isOneValue()) {
+        CallInst *G = IRB.CreateCall(
+            Guard, {Holds, CB->getArgOperand(2), CB->getArgOperand(3)},
+            {OperandBundleDef("deopt", None)});
+        G->setDebugLoc(CB->getDebugLoc());
+      }
+      CB->eraseFromParent();
+      Lowered++;
+    }
+  }
+  return Lowered;
+}
+
+/**
+ * @brief Split a guard condition into the compares we tagged, looking
+ * through the `and`s guard widening combines them with.
+ *
+ * @return false if some part of the condition is not one of our compares
+ */
+static bool collectCheckCompares(Value *Cond,
+                                 SmallVectorImpl<ICmpInst *> &Compares) {
+  SmallVector<Value *, 8> Worklist{Cond};
+  while (!Worklist.empty()) {
+    Value *V = Worklist.pop_back_val();
+    auto *BO = dyn_cast<BinaryOperator>(V);
+    if (BO && BO->getOpcode() == Instruction::And) {
+      Worklist.push_back(BO->getOperand(0));
+      Worklist.push_back(BO->getOperand(1));
+      continue;
+    }
+    auto *Cmp = dyn_cast<ICmpInst>(V);
+    if (!Cmp || Cmp->getPredicate() != CmpInst::ICMP_SLE ||
+        !Cmp->getMetadata(GUARD_CHECK_KEY))
+      return false;
+    Compares.push_back(Cmp);
+  }
+  return true;
+}
+
+/**
+ * @brief Turn the guards lowerChecksToGuards() made, possibly widened by
+ * GuardWidening, back into check calls the optimization phases work on.
+ * Guards with any other condition are left alone.
+ *
+ * @return the number of checks created
+ */
+unsigned liftGuardsToChecks(Function &F) {
+  Module &M = *F.getParent();
+  FunctionCallee CheckLower = getOrInsertCheck(M, CHECK_LB);
+  FunctionCallee CheckUpper = getOrInsertCheck(M, CHECK_UB);
+  IRBuilder<> IRB(F.getContext());
+  unsigned Lifted = 0;
+  for (auto &BB : F) {
+    for (auto &I : make_early_inc_range(BB)) {
+      auto *G = dyn_cast<IntrinsicInst>(&I);
+      if (!G || G->getIntrinsicID() != Intrinsic::experimental_guard ||
+          G->arg_size() != 3)
+        continue;
+      SmallVector<ICmpInst *, 4> Compares;
+      if (!collectCheckCompares(G->getArgOperand(0), Compares))
+        continue;
+
+      IRB.SetInsertPoint(G);
+      for (auto *Cmp : Compares) {
+        auto *Kind = cast<MDString>(
+            Cmp->getMetadata(GUARD_CHECK_KEY)->getOperand(0).get());
+        bool IsUpper = Kind->getString() == "upper";
+        Value *Bound = IsUpper ? Cmp->getOperand(1) : Cmp->getOperand(0);
+        Value *Index = IsUpper ? Cmp->getOperand(0) : Cmp->getOperand(1);
+        CallInst *CB = IRB.CreateCall(
+            IsUpper ? CheckUpper : CheckLower,
+            {Bound, Index, G->getArgOperand(1), G->getArgOperand(2)});
+        CB->setDebugLoc(G->getDebugLoc());
+        Lifted++;
+      }
+      Value *Cond = G->getArgOperand(0);
+      G->eraseFromParent();
+      RecursivelyDeleteTriviallyDeadInstructions(Cond);
+    }
+  }
+  return Lifted;
+}
+
+PreservedAnalyses CheckGuardLowering::run(Function &F,
+                                          FunctionAnalysisManager &FAM) {
+  if (!isCProgram(F.getParent()) && isCxxSTLFunc(F.getName())) {
+    return PreservedAnalyses::all();
+  }
+  unsigned Lowered = lowerChecksToGuards(F);
+  if (!Lowered) {
+    return PreservedAnalyses::all();
+  }
+  VERBOSE_PRINT {
+    llvm::errs() << "Lowered " << Lowered << " checks to guards in "
+                 << F.getName() << "\n";
+  }
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  return PA;
+}
+
+CheckGuardLowering::~CheckGuardLowering() {}
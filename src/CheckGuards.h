@@ -0,0 +1,27 @@
+#ifndef CHECK_GUARDS_H
+#define CHECK_GUARDS_H
+
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+/**
+ * @brief Rewrite check calls as `llvm.experimental.guard`s of the checked
+ * predicate, so GuardWidening, LoopPredication and the guard lowering of the
+ * standard pipeline take over. A failing guard deoptimizes into
+ * `__llvm_deoptimize` of the runtime, which reports the access and aborts.
+ */
+class CheckGuardLowering : public llvm::PassInfoMixin<CheckGuardLowering> {
+public:
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &FAM);
+  static bool isRequired() { return true; }
+  virtual ~CheckGuardLowering();
+};
+
+// Helpers shared with check-ins and check-opt
+
+unsigned lowerChecksToGuards(llvm::Function &F);
+
+unsigned liftGuardsToChecks(llvm::Function &F);
+
+#endif // CHECK_GUARDS_H
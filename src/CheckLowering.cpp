@@ -0,0 +1,214 @@
+#include "CheckLowering.h"
+#include "CommonDef.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+using namespace llvm;
+
+static FunctionCallee getOrInsertBoundViolationReport(Module &M) {
+  LLVMContext &Context = M.getContext();
+  AttributeList Attr = AttributeList::get(
+      Context, AttributeList::FunctionIndex,
+      {Attribute::NoReturn, Attribute::NoUnwind, Attribute::Cold});
+  return M.getOrInsertFunction(CHECK_FAIL, Attr, Type::getVoidTy(Context),
+                               PointerType::getUnqual(Context),
+                               Type::getInt64Ty(Context));
+}
+
+/**
+ * @brief A five byte NOP, asm goto to the out of line check. Its address, the
+ * check's address and the site are recorded in the bound_check_sleds section,
+ * where the runtime finds the sleds it patches into a `jmp`.
+ *
+ * Operands: the check block, the function name, the file and the line.
+ */
+static FunctionCallee getCheckSledAsm(LLVMContext &Context) {
+  Type *Ptr = PointerType::getUnqual(Context);
+  auto *FTy = FunctionType::get(Type::getVoidTy(Context),
+                                {Ptr, Ptr, Ptr, Type::getInt64Ty(Context)},
+                                false);
+  auto *IA = InlineAsm::get(FTy,
+                            "1:\n\t"
+                            ".byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n\t"
+                            ".pushsection bound_check_sleds,\"aw\",@progbits\n\t"
+                            ".p2align 3\n\t"
+                            ".quad 1b, ${0:l}, ${1:c}, ${2:c}, ${3:c}\n\t"
+                            ".popsection",
+                            "X,i,i,i,~{dirflag},~{fpsr},~{flags}",
+                            /*hasSideEffects=*/true);
+  return FunctionCallee(FTy, IA);
+}
+
+/**
+ * @brief Sleds are x86-64 code. Their records would point into discarded
+ * sections for functions in a COMDAT, which keep plain branches.
+ */
+static bool canUseCheckSleds(Function &F) {
+  Triple TT(F.getParent()->getTargetTriple());
+  return PATCHABLE_CHECKS && TT.getArch() == Triple::x86_64 && !F.hasComdat();
+}
+
+/**
+ * @brief PROFILE_CHECKS: give every check its record in the profiled sites
+ * section and count its executions there. When the count before this one has
+ * no bit of the runtime's period mask set, the call runs between two reads of
+ * the cycle counter, which the record sums. The span is what the check costs
+ * the caller: the argument setup, the call, the compare and the return.
+ */
+static void profileChecks(Function &F, ArrayRef<CallInst *> Checks) {
+  Module &M = *F.getParent();
+  LLVMContext &Context = F.getContext();
+  IRBuilder<> IRB(Context);
+  auto *SiteTy =
+      StructType::get(IRB.getInt64Ty(), IRB.getInt64Ty(), IRB.getInt64Ty(),
+                      IRB.getPtrTy(), IRB.getInt64Ty(), IRB.getPtrTy());
+  Constant *FunctionName =
+      IRB.CreateGlobalString(F.getName(), "bound.profile.fn", 0, &M);
+  Constant *PeriodMask =
+      M.getOrInsertGlobal(PROFILE_PERIOD_MASK, IRB.getInt64Ty());
+  Function *ReadTimer =
+      Intrinsic::getDeclaration(&M, Intrinsic::readcyclecounter);
+  MDNode *Unlikely = MDBuilder(Context).createBranchWeights(1, 1023);
+
+  for (auto *CB : Checks) {
+    auto *FileGV =
+        dyn_cast<GlobalVariable>(CB->getArgOperand(2)->stripPointerCasts());
+    auto *LineC = dyn_cast<ConstantInt>(CB->getArgOperand(3));
+    auto *Site = new GlobalVariable(
+        M, SiteTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+        ConstantStruct::get(
+            SiteTy, {IRB.getInt64(0), IRB.getInt64(0), IRB.getInt64(0),
+                     FileGV ? static_cast<Constant *>(FileGV)
+                            : ConstantPointerNull::get(IRB.getPtrTy()),
+                     LineC ? LineC : IRB.getInt64(0), FunctionName}),
+        "bound.profile.site");
+    Site->setSection(PROFILED_SITES_SECTION);
+    Site->setAlignment(Align(8));
+    appendToCompilerUsed(M, {Site});
+
+    StringRef Name = CB->getParent()->getName();
+    Name.consume_back(".checked");
+    IRB.SetInsertPoint(CB);
+    Value *CallsPtr = IRB.CreateStructGEP(SiteTy, Site, 0);
+    Value *Calls = IRB.CreateLoad(IRB.getInt64Ty(), CallsPtr);
+    IRB.CreateStore(IRB.CreateAdd(Calls, IRB.getInt64(1)), CallsPtr);
+    Value *Phase =
+        IRB.CreateAnd(Calls, IRB.CreateLoad(IRB.getInt64Ty(), PeriodMask));
+    Instruction *TimedTerm, *UntimedTerm;
+    SplitBlockAndInsertIfThenElse(IRB.CreateICmpEQ(Phase, IRB.getInt64(0)),
+                                  CB, &TimedTerm, &UntimedTerm, Unlikely);
+    TimedTerm->getParent()->setName(Name + ".timed");
+    UntimedTerm->getParent()->setName(Name + ".untimed");
+    CB->getParent()->setName(Name + ".checked");
+
+    IRB.SetInsertPoint(TimedTerm);
+    Value *Start = IRB.CreateCall(ReadTimer);
+    IRB.Insert(CB->clone());
+    Value *Cycles = IRB.CreateSub(IRB.CreateCall(ReadTimer), Start);
+    auto addToField = [&](unsigned Field, Value *V) {
+      Value *FieldPtr = IRB.CreateStructGEP(SiteTy, Site, Field);
+      Value *Sum = IRB.CreateLoad(IRB.getInt64Ty(), FieldPtr);
+      IRB.CreateStore(IRB.CreateAdd(Sum, V), FieldPtr);
+    };
+    addToField(1, IRB.getInt64(1));
+    addToField(2, Cycles);
+    CB->moveBefore(UntimedTerm);
+  }
+
+  VERBOSE_PRINT {
+    llvm::errs() << "Profiled " << Checks.size() << " checks in "
+                 << F.getName() << "\n";
+  }
+}
+
+PreservedAnalyses CheckLowering::run(Function &F,
+                                     FunctionAnalysisManager &FAM) {
+  SmallVector<CallInst *, 16> Checks;
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      if (isBoundCheckCall(&I))
+        Checks.push_back(cast<CallInst>(&I));
+    }
+  }
+  if (Checks.empty()) {
+    return PreservedAnalyses::all();
+  }
+  if (PROFILE_CHECKS) {
+    profileChecks(F, Checks);
+    return PreservedAnalyses::none();
+  }
+
+  LLVMContext &Context = F.getContext();
+  IRBuilder<> IRB(Context);
+  // every failing check branches here with the location it reports
+  auto *Trap = BasicBlock::Create(Context, "bound.trap", &F);
+  IRB.SetInsertPoint(Trap);
+  PHINode *File = IRB.CreatePHI(IRB.getPtrTy(), Checks.size(), "file");
+  PHINode *Line = IRB.CreatePHI(IRB.getInt64Ty(), Checks.size(), "line");
+  IRB.CreateCall(getOrInsertBoundViolationReport(*F.getParent()),
+                 {File, Line});
+  IRB.CreateUnreachable();
+
+  bool UseSleds = canUseCheckSleds(F);
+  Constant *FunctionName = nullptr;
+  if (UseSleds) {
+    FunctionName = IRB.CreateGlobalString(F.getName(), "bound.sled.fn", 0,
+                                          F.getParent());
+  }
+
+  MDNode *Unlikely = MDBuilder(Context).createBranchWeights(1, (1U << 20) - 1);
+  for (auto *CB : Checks) {
+    BasicBlock *BB = CB->getParent();
+    StringRef Name = BB->getName();
+    Name.consume_back(".checked");
+    BasicBlock *Cont =
+        BB->splitBasicBlock(CB->getNextNode(), Name + ".checked");
+    BB->getTerminator()->eraseFromParent();
+
+    // with sleds the check only runs once the runtime patched its NOP
+    BasicBlock *CheckBB = BB;
+    if (UseSleds) {
+      CheckBB = BasicBlock::Create(Context, Name + ".sled", &F, Trap);
+      auto *FileGV = dyn_cast<GlobalVariable>(
+          CB->getArgOperand(2)->stripPointerCasts());
+      auto *LineC = dyn_cast<ConstantInt>(CB->getArgOperand(3));
+      IRB.SetInsertPoint(BB);
+      IRB.CreateCallBr(getCheckSledAsm(Context), Cont, {CheckBB},
+                       {BlockAddress::get(&F, CheckBB), FunctionName,
+                        FileGV ? static_cast<Constant *>(FileGV)
+                               : ConstantPointerNull::get(IRB.getPtrTy()),
+                        LineC ? LineC : IRB.getInt64(0)});
+    }
+
+    Value *Bound = CB->getArgOperand(0);
+    Value *Index = CB->getArgOperand(1);
+    IRB.SetInsertPoint(CheckBB);
+    Value *Fails = CB->getCalledFunction()->getName() == CHECK_UB
+                       ? IRB.CreateICmpSGT(Index, Bound)
+                       : IRB.CreateICmpSLT(Index, Bound);
+    IRB.CreateCondBr(Fails, Trap, Cont, Unlikely);
+    File->addIncoming(CB->getArgOperand(2), CheckBB);
+    Line->addIncoming(CB->getArgOperand(3), CheckBB);
+    CB->eraseFromParent();
+  }
+
+  // all checks of a module usually name the same file
+  for (auto *PN : {File, Line}) {
+    if (Value *V = PN->hasConstantValue()) {
+      PN->replaceAllUsesWith(V);
+      PN->eraseFromParent();
+    }
+  }
+
+  VERBOSE_PRINT {
+    llvm::errs() << "Lowered " << Checks.size() << " checks in "
+                 << F.getName() << (UseSleds ? " to sleds\n" : "\n");
+  }
+  return PreservedAnalyses::none();
+}
+
+CheckLowering::~CheckLowering() {}
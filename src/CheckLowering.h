@@ -0,0 +1,23 @@
+#ifndef CHECK_LOWERING_H
+#define CHECK_LOWERING_H
+
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+/**
+ * @brief Expand the checks, calls with known semantics up to here, into a
+ * compare and a branch to one trap block per function. Runs last in the
+ * optimization pipeline, so the middle end only sees one cheap call per check
+ * and code generation gets plain branches. With PATCHABLE_CHECKS the branch
+ * is moved behind a NOP sled the runtime can patch. With PROFILE_CHECKS the
+ * checks stay calls and are timed instead.
+ */
+class CheckLowering : public llvm::PassInfoMixin<CheckLowering> {
+public:
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &FAM);
+  static bool isRequired() { return true; }
+  virtual ~CheckLowering();
+};
+
+#endif // CHECK_LOWERING_H
@@ -1,6 +1,12 @@
 #include "CommonDef.h"
 #include "llvm/Demangle/Demangle.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Operator.h"
 #include <cstdlib>
 
 using namespace std;
@@ -29,7 +35,8 @@ __attribute__((constructor)) void libInit() {
 bool isCxxSTLFunc(StringRef FuncName) {
   bool IsSTL = false;
   string Res = demangle(FuncName.data());
-  StringRef DemangledName(Res);
+  // only the qualified name counts, parameters may well be std types
+  StringRef DemangledName = StringRef(Res).split('(').first;
   size_t FirstSRO = DemangledName.find("::");
   if (FirstSRO != StringRef::npos) {
     StringRef Prefix = DemangledName.substr(0, FirstSRO);
@@ -51,6 +58,257 @@ bool isCProgram(Module *M) {
   }
 }
 
+bool isBoundCheckCall(const Instruction *I) {
+  const auto *CI = dyn_cast<CallInst>(I);
+  if (!CI || !CI->getCalledFunction()) {
+    return false;
+  }
+  StringRef Name = CI->getCalledFunction()->getName();
+  return Name == CHECK_LB || Name == CHECK_UB;
+}
+
+FunctionCallee getOrInsertBoundLookup(Module &M) {
+  LLVMContext &Context = M.getContext();
+  // the table only changes in malloc and free, which are opaque calls
+  AttributeList Attr = AttributeList::get(
+      Context, AttributeList::FunctionIndex,
+      {Attribute::ReadOnly, Attribute::NoUnwind, Attribute::WillReturn});
+  return M.getOrInsertFunction(BOUND_LOOKUP, Attr, Type::getInt64Ty(Context),
+                               PointerType::getUnqual(Context),
+                               Type::getInt64Ty(Context));
+}
+
+/**
+ * @brief Declare checkLowerBound or checkUpperBound. The runtime reports a
+ * failed check on stderr and returns. Of the program's memory it only reads
+ * the file name string it is passed, so optimizers may move the calls and
+ * vectorize loops containing them.
+ */
+FunctionCallee getOrInsertCheck(Module &M, StringRef Name) {
+  LLVMContext &Context = M.getContext();
+  FunctionCallee Check = M.getOrInsertFunction(
+      Name, Type::getVoidTy(Context), Type::getInt64Ty(Context),
+      Type::getInt64Ty(Context), PointerType::getUnqual(Context),
+      Type::getInt64Ty(Context));
+  // the declaration may come from an earlier pass or another module
+  if (auto *Fn = dyn_cast<Function>(Check.getCallee())) {
+    Fn->addFnAttr(Attribute::NoUnwind);
+    Fn->addFnAttr(Attribute::WillReturn);
+    Fn->removeFnAttr(Attribute::InaccessibleMemOnly);
+    Fn->addFnAttr(Attribute::InaccessibleMemOrArgMemOnly);
+    Fn->addParamAttr(2, Attribute::ReadOnly);
+    Fn->addParamAttr(2, Attribute::NoCapture);
+  }
+  return Check;
+}
+
+/**
+ * @brief The pointer an access reads or writes through, including the masked
+ * and gather/scatter intrinsics the vectorizers emit, or nullptr.
+ */
+const Value *getAccessedPointer(const Instruction *I) {
+  if (const auto *LI = dyn_cast<LoadInst>(I))
+    return LI->getPointerOperand();
+  if (const auto *SI = dyn_cast<StoreInst>(I))
+    return SI->getPointerOperand();
+  if (const auto *II = dyn_cast<IntrinsicInst>(I)) {
+    switch (II->getIntrinsicID()) {
+    case Intrinsic::masked_load:
+    case Intrinsic::masked_gather:
+      return II->getArgOperand(0);
+    case Intrinsic::masked_store:
+    case Intrinsic::masked_scatter:
+      return II->getArgOperand(1);
+    default:
+      break;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief The lane mask of a masked access, or nullptr if every lane is
+ * accessed.
+ */
+Value *getAccessMask(const Instruction *I) {
+  const auto *II = dyn_cast<IntrinsicInst>(I);
+  if (!II)
+    return nullptr;
+  switch (II->getIntrinsicID()) {
+  case Intrinsic::masked_load:
+  case Intrinsic::masked_gather:
+    return II->getArgOperand(2);
+  case Intrinsic::masked_store:
+  case Intrinsic::masked_scatter:
+    return II->getArgOperand(3);
+  default:
+    return nullptr;
+  }
+}
+
+Argument *getArrayBoundArgument(const Argument &Arg) {
+  const Function *F = Arg.getParent();
+  Attribute Attr =
+      F->getAttributes().getParamAttr(Arg.getArgNo(), ARRAY_BOUND_ATTR);
+  unsigned BoundArgNo;
+  if (!Attr.isValid() || Attr.getValueAsString().getAsInteger(10, BoundArgNo) ||
+      BoundArgNo >= F->arg_size()) {
+    return nullptr;
+  }
+  return F->getArg(BoundArgNo);
+}
+
+/**
+ * @brief Strip casts and all-zero GEPs, e.g. the decay of an array to a
+ * pointer to its first element.
+ */
+Value *stripZeroOffsets(Value *V) {
+  while (true) {
+    V = V->stripPointerCasts();
+    auto *GEP = dyn_cast<GEPOperator>(V);
+    if (!GEP || !GEP->hasAllZeroIndices())
+      return V;
+    V = GEP->getPointerOperand();
+  }
+}
+
+/**
+ * @brief Calls to malloc, calloc, realloc, aligned_alloc or `new[]`, which
+ * return a fresh heap array.
+ */
+bool isAllocationCall(const Value *V) {
+  const auto *CB = dyn_cast<CallBase>(V);
+  if (!CB || !CB->getCalledFunction()) {
+    return false;
+  }
+  return StringSwitch<bool>(CB->getCalledFunction()->getName())
+      .Cases("malloc", "calloc", "realloc", "aligned_alloc", true)
+      .Cases("_Znam", "_ZnamRKSt9nothrow_t", "_ZnamSt11align_val_t",
+             "_ZnamSt11align_val_tRKSt9nothrow_t", true)
+      .Default(false);
+}
+
+// n * sizeof(T), sizeof(T) * n or n << log2(sizeof(T)) holds n elements
+static Value *getScaledOperand(Value *Bytes, uint64_t ElemSize) {
+  auto *BO = dyn_cast<BinaryOperator>(Bytes);
+  if (!BO) {
+    return nullptr;
+  }
+  if (BO->getOpcode() == Instruction::Mul) {
+    for (unsigned k = 0; k < 2; k++) {
+      auto *C = dyn_cast<ConstantInt>(BO->getOperand(k));
+      if (C && C->getZExtValue() == ElemSize) {
+        return BO->getOperand(1 - k);
+      }
+    }
+  } else if (BO->getOpcode() == Instruction::Shl) {
+    auto *C = dyn_cast<ConstantInt>(BO->getOperand(1));
+    if (C && C->getZExtValue() < 64 &&
+        (uint64_t(1) << C->getZExtValue()) == ElemSize) {
+      return BO->getOperand(0);
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief The number of elements of ElemSize bytes in a heap allocation or a
+ * dynamically sized alloca. The count is read off the size operands when
+ * they are an exact product, otherwise it is recomputed from the byte size
+ * at the insertion point of IRB.
+ *
+ * @return an i64 count, or nullptr if Allocation is not an allocation
+ */
+Value *getAllocationElementCount(IRBuilder<> &IRB, Instruction *Allocation,
+                                 uint64_t ElemSize) {
+  const DataLayout &DL = Allocation->getModule()->getDataLayout();
+  if (ElemSize == 0) {
+    return nullptr;
+  }
+  // the allocation is Count units of UnitSize bytes
+  Value *Count = nullptr;
+  uint64_t UnitSize = 1;
+  if (auto *AI = dyn_cast<AllocaInst>(Allocation)) {
+    Count = AI->getArraySize();
+    UnitSize = DL.getTypeAllocSize(AI->getAllocatedType()).getFixedSize();
+  } else if (isAllocationCall(Allocation)) {
+    auto *CB = cast<CallBase>(Allocation);
+    StringRef Name = CB->getCalledFunction()->getName();
+    if (Name == "calloc") {
+      // calloc(n, size), either operand may be the sizeof
+      auto *C = dyn_cast<ConstantInt>(CB->getArgOperand(1));
+      unsigned CountArg = 0;
+      if (!C) {
+        C = dyn_cast<ConstantInt>(CB->getArgOperand(0));
+        CountArg = 1;
+      }
+      if (C) {
+        Count = CB->getArgOperand(CountArg);
+        UnitSize = C->getZExtValue();
+      } else {
+        Count = IRB.CreateMul(CB->getArgOperand(0), CB->getArgOperand(1));
+      }
+    } else if (Name == "realloc" || Name == "aligned_alloc") {
+      Count = CB->getArgOperand(1);
+    } else {
+      Count = CB->getArgOperand(0);
+    }
+  } else {
+    return nullptr;
+  }
+
+  if (auto *C = dyn_cast<ConstantInt>(Count)) {
+    return IRB.getInt64(C->getZExtValue() * UnitSize / ElemSize);
+  }
+  if (UnitSize == ElemSize) {
+    return IRB.CreateZExtOrTrunc(Count, IRB.getInt64Ty());
+  }
+  if (UnitSize == 1) {
+    if (Value *Scaled = getScaledOperand(Count, ElemSize)) {
+      return IRB.CreateZExtOrTrunc(Scaled, IRB.getInt64Ty());
+    }
+  }
+  Value *Bytes = IRB.CreateZExtOrTrunc(Count, IRB.getInt64Ty());
+  if (UnitSize != 1) {
+    Bytes = IRB.CreateMul(Bytes, IRB.getInt64(UnitSize));
+  }
+  return IRB.CreateUDiv(Bytes, IRB.getInt64(ElemSize));
+}
+
+bool hasFunctionAnnotation(const Function &F, StringRef Annotation) {
+  if (F.hasFnAttribute(Annotation)) {
+    return true;
+  }
+  // clang lowers `__attribute__((annotate("...")))` on a function to an
+  // entry {function, string, file, line, args} of llvm.global.annotations
+  const auto *Annotations =
+      F.getParent()->getNamedGlobal("llvm.global.annotations");
+  if (!Annotations || !Annotations->hasInitializer()) {
+    return false;
+  }
+  const auto *Entries = dyn_cast<ConstantArray>(Annotations->getInitializer());
+  if (!Entries) {
+    return false;
+  }
+  for (const auto &Op : Entries->operands()) {
+    const auto *Entry = dyn_cast<ConstantStruct>(Op);
+    if (!Entry || Entry->getNumOperands() < 2 ||
+        Entry->getOperand(0)->stripPointerCasts() != &F) {
+      continue;
+    }
+    const auto *GV =
+        dyn_cast<GlobalVariable>(Entry->getOperand(1)->stripPointerCasts());
+    if (!GV || !GV->hasInitializer()) {
+      continue;
+    }
+    const auto *Str = dyn_cast<ConstantDataArray>(GV->getInitializer());
+    if (Str && Str->isCString() && Str->getAsCString() == Annotation) {
+      return true;
+    }
+  }
+  return false;
+}
+
 raw_ostream &verboseOut() {
   return IsVerbose ? errs() : nulls();
 }
@@ -1,6 +1,7 @@
 #ifndef COMMON_DEF_H
 #define COMMON_DEF_H
 
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/WithColor.h"
@@ -15,6 +16,34 @@ constexpr auto SOURCE_FILE_NAME = "__source_file_name__";
 constexpr auto CHECK_LB = "checkLowerBound";
 constexpr auto CHECK_UB = "checkUpperBound";
 
+// reached from the trap block check-lower expands checks to,
+// `void reportBoundViolation(ptr file, i64 line)`, does not return
+constexpr auto CHECK_FAIL = "reportBoundViolation";
+
+// runtime bounds table lookup, `i64 lookupBound(ptr base, i64 elemSize)`
+constexpr auto BOUND_LOOKUP = "lookupBound";
+
+// section of the `{ i8 violated, ptr file, i64 line }` records of the sites
+// INDEX_MASKING clamps, read by stubs/MaskedSites.cpp at exit
+constexpr auto MASKED_SITES_SECTION = "bound_masked_sites";
+
+// section of the `{ i64 calls, i64 samples, i64 cycles, ptr file, i64 line,
+// ptr function }` records of the sites PROFILE_CHECKS times, read by
+// stubs/BoundCheckProfile.cpp at exit
+constexpr auto PROFILED_SITES_SECTION = "bound_profiled_sites";
+
+// `i64` defined by stubs/BoundCheckProfile.cpp, a profiled site times the
+// executions whose call count has no bits of it set
+constexpr auto PROFILE_PERIOD_MASK = "boundProfilePeriodMask";
+
+// parameter attribute of a pointer parameter, its value is the argument
+// number of the parameter holding the element count
+constexpr auto ARRAY_BOUND_ATTR = "array-bound";
+
+// function attribute or `__attribute__((annotate(...)))` selecting the
+// dominator tree walk instead of the full dataflow in check-opt
+constexpr auto FAST_ELIMINATION_ANNOTATION = "bound-check-fast";
+
 #define _DEBUG_PRINT 0
 
 // #ifdef VERBOSE_PRINT_LEVEL
@@ -44,6 +73,72 @@ constexpr auto CHECK_UB = "checkUpperBound";
 #define CLEAN_REDUNDANT_CHECK_IN_SAME_BB ELIMINATION
 // #endif
 
+// accesses without a static bound look it up in the runtime bounds table,
+// the program must be linked with stubs/BoundTable.o
+// #ifndef RUNTIME_BOUNDS_TABLE
+#define RUNTIME_BOUNDS_TABLE false
+// #endif
+
+// checks are moved within their block to where the fewest values are live
+// across the call
+// #ifndef PRESSURE_AWARE_PLACEMENT
+#define PRESSURE_AWARE_PLACEMENT true
+// #endif
+
+// every check check-opt leaves where and as check-ins placed it, in front of
+// its load or store, is followed by an llvm.assume of what it checked, so later
+// passes may rely on the bound
+// #ifndef ASSUME_CHECKED_BOUNDS
+#define ASSUME_CHECKED_BOUNDS true
+// #endif
+
+// checks leave check-ins and check-opt as llvm.experimental.guard calls for
+// the guard passes of LLVM, the runtime must provide __llvm_deoptimize
+// #ifndef GUARD_CHECKS
+#define GUARD_CHECKS false
+// #endif
+
+// check-lower runs at the end of the default optimization pipelines, the
+// expanded checks stop the program at the first failure instead of reporting
+// and continuing
+// #ifndef LATE_CHECK_LOWERING
+#define LATE_CHECK_LOWERING false
+// #endif
+
+// check-lower emits every check as a NOP sled that jumps to the out of line
+// check once patched, the runtime in stubs/CheckSleds.cpp switches them on
+// #ifndef PATCHABLE_CHECKS
+#define PATCHABLE_CHECKS false
+// #endif
+
+// check-lower keeps the checks calls, counts their executions per site and
+// brackets one in a period with llvm.readcyclecounter, for the runtime in
+// stubs/BoundCheckProfile.cpp
+// #ifndef PROFILE_CHECKS
+#define PROFILE_CHECKS false
+// #endif
+
+// check-ins clamps subscripts into their bounds instead of checking them, a
+// violation only sets the sticky flag of its site
+// #ifndef INDEX_MASKING
+#define INDEX_MASKING false
+// #endif
+
+// check-ins only checks accesses that may write, those that can corrupt
+// memory: stores, memory intrinsic destinations and escaping pointers
+// #ifndef WRITE_ONLY_CHECKS
+#define WRITE_ONLY_CHECKS false
+// #endif
+
+// #ifndef MAX_OPTIMIZATION_ROUNDS
+#define MAX_OPTIMIZATION_ROUNDS 4
+// #endif
+
+// functions with more blocks than this always use the fast elimination
+// #ifndef FAST_ELIMINATION_BLOCK_THRESHOLD
+#define FAST_ELIMINATION_BLOCK_THRESHOLD 2000
+// #endif
+
 // #ifndef DUMP_STATS
 #define DUMP_STATS true
 // #endif
@@ -75,6 +170,29 @@ bool isCxxSTLFunc(llvm::StringRef Name);
 
 bool isCProgram(llvm::Module *M);
 
+bool isBoundCheckCall(const llvm::Instruction *I);
+
+llvm::FunctionCallee getOrInsertBoundLookup(llvm::Module &M);
+
+llvm::FunctionCallee getOrInsertCheck(llvm::Module &M, llvm::StringRef Name);
+
+const llvm::Value *getAccessedPointer(const llvm::Instruction *I);
+
+llvm::Value *getAccessMask(const llvm::Instruction *I);
+
+llvm::Argument *getArrayBoundArgument(const llvm::Argument &Arg);
+
+llvm::Value *stripZeroOffsets(llvm::Value *V);
+
+bool isAllocationCall(const llvm::Value *V);
+
+llvm::Value *getAllocationElementCount(llvm::IRBuilder<> &IRB,
+                                       llvm::Instruction *Allocation,
+                                       uint64_t ElemSize);
+
+bool hasFunctionAnnotation(const llvm::Function &F,
+                           llvm::StringRef Annotation);
+
 llvm::raw_ostream &verboseOut();
 
 #endif // COMMON_DEF_H
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include "FunctionVersioning.h"
+#include "BoundCheckOptimization.h"
+#include "BoundPredicateSet.h"
+#include "CommonDef.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+
+constexpr auto VERSIONED_ATTR = "bound-check-versioned";
+
+/**
+ * @brief A subscript expression can be evaluated at the function entry if it
+ * only refers to constants or integer parameters, since they never change
+ * inside the body.
+ */
+static bool isEntryExpressible(const SubscriptExpr &SE) {
+  return SE.isConstant() ||
+         (isa<Argument>(SE.i) && SE.i->getType()->isIntegerTy());
+}
+
+bool FunctionVersioning::versionFunction(Function &F, LoopInfo &LI) {
+  // union of all checks that can be answered at entry, grouped by index
+  MapVector<SubscriptIndentity, BoundPredicateSet> EntryPredicates;
+  SmallVector<CallInst *, 32> GuardedChecks;
+  bool HasCheckInLoop = false;
+
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      if (!isBoundCheckCall(&I))
+        continue;
+      auto *CB = cast<CallInst>(&I);
+      SubscriptExpr BoundExpr = SubscriptExpr::evaluate(CB->getArgOperand(0));
+      SubscriptExpr IndexExpr = SubscriptExpr::evaluate(CB->getArgOperand(1));
+      if (!isEntryExpressible(BoundExpr) || !isEntryExpressible(IndexExpr))
+        continue;
+
+      auto &Predicates = EntryPredicates[IndexExpr.getIdentity()];
+      if (CB->getCalledFunction()->getName() == CHECK_UB) {
+        Predicates.addPredicate(UpperBoundPredicate{BoundExpr, IndexExpr});
+      } else {
+        Predicates.addPredicate(LowerBoundPredicate{BoundExpr, IndexExpr});
+      }
+      GuardedChecks.push_back(CB);
+      HasCheckInLoop |= LI.getLoopFor(&BB) != nullptr;
+    }
+  }
+
+  // checks outside loops already run once per call, nothing to gain
+  if (!HasCheckInLoop)
+    return false;
+
+  ValueToValueMapTy VMap;
+  Function *Unchecked = CloneFunction(&F, VMap);
+  Unchecked->setName(F.getName() + ".unchecked");
+  Unchecked->setLinkage(GlobalValue::InternalLinkage);
+  Unchecked->setComdat(nullptr);
+  Unchecked->addFnAttr(VERSIONED_ATTR);
+  F.addFnAttr(VERSIONED_ATTR);
+
+  for (auto *CB : GuardedChecks) {
+    auto *Cloned = cast<CallInst>(VMap[CB]);
+    Value *Bound = Cloned->getArgOperand(0);
+    Value *Index = Cloned->getArgOperand(1);
+    Cloned->eraseFromParent();
+    RecursivelyClearAllInstructionsUsedOnlyBy(Bound);
+    RecursivelyClearAllInstructionsUsedOnlyBy(Index);
+  }
+
+  LLVMContext &Context = F.getContext();
+  BasicBlock *OldEntry = &F.getEntryBlock();
+  auto *Dispatch =
+      BasicBlock::Create(Context, "version.dispatch", &F, OldEntry);
+  auto *FastPath =
+      BasicBlock::Create(Context, "version.unchecked", &F, OldEntry);
+
+  // static allocas must stay in the entry block
+  for (auto &I : make_early_inc_range(*OldEntry)) {
+    auto *AI = dyn_cast<AllocaInst>(&I);
+    if (AI && isa<ConstantInt>(AI->getArraySize())) {
+      AI->moveBefore(*Dispatch, Dispatch->end());
+    }
+  }
+
+  IRBuilder<> IRB(Dispatch);
+  Instruction *Term = IRB.CreateBr(OldEntry);
+  Value *Precheck = nullptr;
+  auto addToPrecheck = [&](Value *Cond) {
+    Precheck = Precheck ? IRB.CreateAnd(Precheck, Cond) : Cond;
+  };
+  for (auto &[Identity, Predicates] : EntryPredicates) {
+    for (auto &LBP : Predicates.LbPredicates) {
+      Value *Bound = createValueForSubExpr(IRB, Term, LBP.Bound);
+      Value *Index = createValueForSubExpr(IRB, Term, LBP.Index);
+      addToPrecheck(IRB.CreateICmpSLE(Bound, Index));
+    }
+    for (auto &UBP : Predicates.UbPredicates) {
+      Value *Bound = createValueForSubExpr(IRB, Term, UBP.Bound);
+      Value *Index = createValueForSubExpr(IRB, Term, UBP.Index);
+      addToPrecheck(IRB.CreateICmpSLE(Index, Bound));
+    }
+  }
+  IRB.SetInsertPoint(Term);
+  IRB.CreateCondBr(Precheck, FastPath, OldEntry);
+  Term->eraseFromParent();
+
+  IRB.SetInsertPoint(FastPath);
+  SmallVector<Value *, 8> Args;
+  for (auto &Arg : F.args()) {
+    Args.push_back(&Arg);
+  }
+  CallInst *Call = IRB.CreateCall(Unchecked, Args);
+  Call->setTailCall();
+  if (auto *SP = F.getSubprogram()) {
+    Call->setDebugLoc(DILocation::get(Context, SP->getScopeLine(), 0, SP));
+  }
+  if (F.getReturnType()->isVoidTy()) {
+    IRB.CreateRetVoid();
+  } else {
+    IRB.CreateRet(Call);
+  }
+
+  VERBOSE_PRINT {
+    llvm::errs() << "Versioned " << F.getName() << ": "
+                 << GuardedChecks.size()
+                 << " checks replaced by an entry precheck\n";
+  }
+  return true;
+}
+
+PreservedAnalyses FunctionVersioning::run(Module &M,
+                                          ModuleAnalysisManager &MAM) {
+  auto &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  SmallVector<Function *, 16> Candidates;
+  for (auto &F : M) {
+    if (F.isDeclaration() || F.isVarArg() || F.hasFnAttribute(VERSIONED_ATTR))
+      continue;
+    if (!isCProgram(&M) && isCxxSTLFunc(F.getName()))
+      continue;
+    Candidates.push_back(&F);
+  }
+
+  bool Changed = false;
+  for (auto *F : Candidates) {
+    auto &LI = FAM.getResult<LoopAnalysis>(*F);
+    if (versionFunction(*F, LI)) {
+      FAM.invalidate(*F, PreservedAnalyses::none());
+      Changed = true;
+    }
+  }
+  return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
+
+FunctionVersioning::~FunctionVersioning() {}
@@ -0,0 +1,21 @@
+#ifndef FUNCTION_VERSIONING_H
+#define FUNCTION_VERSIONING_H
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+/**
+ * @brief Clone functions whose checks only depend on their parameters into a
+ * check-free version, and dispatch to it when one entry precheck holds.
+ */
+class FunctionVersioning : public llvm::PassInfoMixin<FunctionVersioning> {
+public:
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+  bool versionFunction(llvm::Function &F, llvm::LoopInfo &LI);
+  static bool isRequired() { return true; }
+  virtual ~FunctionVersioning();
+};
+
+#endif // FUNCTION_VERSIONING_H
@@ -0,0 +1,284 @@
+#include "IterationSpaceSplitting.h"
+#include "BoundCheckOptimization.h"
+#include "CommonDef.h"
+#include "Stats.h"
+#include "SubscriptExpr.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+
+// loops with a known trip count below this are not worth tripling
+constexpr unsigned MIN_SPLIT_TRIP_COUNT = 8;
+
+struct SplitCandidate {
+  Loop *L;
+  PHINode *IV;
+  bool Increasing;
+  // checks of the form `Bound <= IV + B` and `IV + B <= Bound` with a loop
+  // invariant Bound, they are all satisfied in the steady state
+  SmallVector<CallInst *, 8> LbChecks;
+  SmallVector<CallInst *, 8> UbChecks;
+};
+
+struct LoopSegment {
+  BasicBlock *Header;
+  // nullptr for the original loop, which is always the last segment
+  ValueToValueMapTy *VMap;
+  // the segment runs while `IV <Pred> Limit`, no limit for the last segment
+  CmpInst::Predicate Pred;
+  Value *Limit;
+};
+
+/**
+ * @brief Match a loop in the shape mem2reg leaves a C `for` loop in: the
+ * header is the only exiting block, and an affine induction variable with a
+ * constant step is used by checks inside the loop. A segment leaving on its
+ * limit hands the same iteration to the next segment, whose header evaluates
+ * the condition again, so the header must be free of side effects.
+ */
+static std::optional<SplitCandidate>
+findSplitCandidate(Loop *L, ScalarEvolution &SE, DominatorTree &DT) {
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Header = L->getHeader();
+  if (!L->isInnermost() || !Preheader || !L->getLoopLatch() ||
+      !L->getUniqueExitBlock() || L->getExitingBlock() != Header ||
+      !L->hasDedicatedExits()) {
+    return std::nullopt;
+  }
+  auto *BI = dyn_cast<BranchInst>(Header->getTerminator());
+  if (!BI || !BI->isConditional()) {
+    return std::nullopt;
+  }
+  // e.g. `while (read(fd, buf, n) > 0)` or `for (; next(&i);)`
+  for (auto &I : Header->instructionsWithoutDebug()) {
+    if (!isa<PHINode>(I) && !I.isTerminator() && I.mayHaveSideEffects())
+      return std::nullopt;
+  }
+  unsigned TripCount = SE.getSmallConstantTripCount(L);
+  if (TripCount != 0 && TripCount < MIN_SPLIT_TRIP_COUNT) {
+    return std::nullopt;
+  }
+
+  SplitCandidate C{L, nullptr, true, {}, {}};
+  for (auto *BB : L->blocks()) {
+    for (auto &I : *BB) {
+      if (!isBoundCheckCall(&I))
+        continue;
+      auto *CB = cast<CallInst>(&I);
+      SubscriptExpr IndexExpr = SubscriptExpr::evaluate(CB->getArgOperand(1));
+      SubscriptExpr BoundExpr = SubscriptExpr::evaluate(CB->getArgOperand(0));
+
+      auto *IV = dyn_cast_or_null<PHINode>((Value *)IndexExpr.i);
+      if (IndexExpr.A != 1 || !IV || IV->getParent() != Header)
+        continue;
+      if (C.IV && C.IV != IV)
+        continue;
+
+      if (!BoundExpr.isConstant()) {
+        // the bound is materialized in the preheader
+        if (BoundExpr.i->getType()->isPointerTy() ||
+            !L->isLoopInvariant(BoundExpr.i))
+          continue;
+        if (auto *BoundInst = dyn_cast<Instruction>(BoundExpr.i)) {
+          if (!DT.dominates(BoundInst, Preheader->getTerminator()))
+            continue;
+        }
+      }
+
+      if (!C.IV) {
+        const auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(IV));
+        if (!AR || AR->getLoop() != L || !AR->isAffine())
+          return std::nullopt;
+        const auto *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+        if (!Step || Step->getValue()->isZero())
+          return std::nullopt;
+        // the IV is compared after widening, it must not wrap
+        if (IV->getType()->getIntegerBitWidth() != 64 &&
+            !AR->hasNoSignedWrap())
+          return std::nullopt;
+        C.IV = IV;
+        C.Increasing = Step->getAPInt().isStrictlyPositive();
+      }
+
+      if (CB->getCalledFunction()->getName() == CHECK_LB) {
+        C.LbChecks.push_back(CB);
+      } else {
+        C.UbChecks.push_back(CB);
+      }
+    }
+  }
+
+  if (!C.IV) {
+    return std::nullopt;
+  }
+  return C;
+}
+
+/**
+ * @brief Compute the tightest IV range of the checks at `Point`: the max of
+ * `Bound - B` over LB checks, or the min over UB checks.
+ */
+static Value *createSteadyStateLimit(IRBuilder<> &IRB, Instruction *Point,
+                                     ArrayRef<CallInst *> Checks,
+                                     Intrinsic::ID Combine) {
+  Value *Limit = nullptr;
+  for (auto *CB : Checks) {
+    SubscriptExpr IndexExpr = SubscriptExpr::evaluate(CB->getArgOperand(1));
+    SubscriptExpr BoundExpr = SubscriptExpr::evaluate(CB->getArgOperand(0));
+    Value *IVLimit = createValueForSubExpr(IRB, Point, BoundExpr - IndexExpr.B);
+    IRB.SetInsertPoint(Point);
+    if (!Limit) {
+      Limit = IVLimit;
+    } else if (isa<ConstantInt>(Limit) && isa<ConstantInt>(IVLimit)) {
+      int64_t A = cast<ConstantInt>(Limit)->getSExtValue();
+      int64_t B = cast<ConstantInt>(IVLimit)->getSExtValue();
+      Limit = IRB.getInt64(Combine == Intrinsic::smax ? std::max(A, B)
+                                                      : std::min(A, B));
+    } else {
+      Limit = IRB.CreateBinaryIntrinsic(Combine, Limit, IVLimit);
+    }
+  }
+  return Limit;
+}
+
+static BasicBlock *cloneLoop(Loop *L, ValueToValueMapTy &VMap,
+                             const Twine &Suffix) {
+  Function *F = L->getHeader()->getParent();
+  SmallVector<BasicBlock *, 16> NewBlocks;
+  for (auto *BB : L->blocks()) {
+    auto *NewBB = CloneBasicBlock(BB, VMap, Suffix, F);
+    VMap[BB] = NewBB;
+    NewBlocks.push_back(NewBB);
+  }
+  remapInstructionsInBlocks(NewBlocks, VMap);
+  return cast<BasicBlock>(VMap[L->getHeader()]);
+}
+
+static Value *mapped(LoopSegment &S, Value *V) {
+  return S.VMap ? static_cast<Value *>((*S.VMap)[V]) : V;
+}
+
+static void splitLoop(SplitCandidate &C) {
+  Loop *L = C.L;
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *Exit = L->getUniqueExitBlock();
+  LLVMContext &Context = Header->getContext();
+
+  IRBuilder<> IRB(Preheader->getTerminator());
+  Instruction *PHTerm = Preheader->getTerminator();
+  Value *Lo = createSteadyStateLimit(IRB, PHTerm, C.LbChecks, Intrinsic::smax);
+  Value *Hi = createSteadyStateLimit(IRB, PHTerm, C.UbChecks, Intrinsic::smin);
+
+  // the prologue runs until the IV enters [Lo, Hi], the steady state until it
+  // leaves it again
+  Value *PrologueLimit = C.Increasing ? Lo : Hi;
+  Value *SteadyLimit = C.Increasing ? Hi : Lo;
+  auto ProloguePred = C.Increasing ? CmpInst::ICMP_SLT : CmpInst::ICMP_SGT;
+  auto SteadyPred = C.Increasing ? CmpInst::ICMP_SLE : CmpInst::ICMP_SGE;
+
+  ValueToValueMapTy PrologueVMap, SteadyVMap;
+  SmallVector<LoopSegment, 3> Segments;
+  if (PrologueLimit) {
+    Segments.push_back({cloneLoop(L, PrologueVMap, ".prologue"),
+                        &PrologueVMap, ProloguePred, PrologueLimit});
+  }
+  if (SteadyLimit) {
+    Segments.push_back({cloneLoop(L, SteadyVMap, ".steady"), &SteadyVMap,
+                        SteadyPred, SteadyLimit});
+    Segments.push_back({Header, nullptr, CmpInst::BAD_ICMP_PREDICATE, nullptr});
+  } else {
+    // no epilogue needed, the original loop is the steady state
+    Segments.push_back({Header, nullptr, CmpInst::BAD_ICMP_PREDICATE, nullptr});
+  }
+  LoopSegment &Steady = SteadyLimit ? Segments[Segments.size() - 2]
+                                    : Segments.back();
+
+  PHTerm->replaceSuccessorWith(Header, Segments.front().Header);
+
+  for (size_t k = 0; k + 1 < Segments.size(); k++) {
+    LoopSegment &S = Segments[k];
+    LoopSegment &Next = Segments[k + 1];
+
+    // stay in the segment only while the IV is below its limit
+    auto *BI = cast<BranchInst>(S.Header->getTerminator());
+    IRB.SetInsertPoint(BI);
+    Value *IV = IRB.CreateSExtOrTrunc(mapped(S, C.IV), IRB.getInt64Ty());
+    Value *InRange = IRB.CreateICmp(S.Pred, IV, S.Limit);
+    Value *Cond = BI->getCondition();
+    if (BI->getSuccessor(1) == Exit) {
+      BI->setCondition(IRB.CreateAnd(Cond, InRange));
+    } else {
+      BI->setCondition(IRB.CreateOr(Cond, IRB.CreateNot(InRange)));
+    }
+
+    // leave through a new preheader of the next segment
+    auto *Bridge = BasicBlock::Create(Context, Header->getName() + ".split",
+                                      Header->getParent(), Next.Header);
+    BranchInst::Create(Next.Header, Bridge);
+    BI->replaceSuccessorWith(Exit, Bridge);
+
+    // the next segment continues from the values the header had on exit
+    for (auto &Phi : Header->phis()) {
+      auto *NextPhi = cast<PHINode>(mapped(Next, &Phi));
+      int Idx = NextPhi->getBasicBlockIndex(Preheader);
+      NextPhi->setIncomingBlock(Idx, Bridge);
+      NextPhi->setIncomingValue(Idx, mapped(S, &Phi));
+    }
+  }
+
+  for (auto *CB : concat<CallInst *>(C.LbChecks, C.UbChecks)) {
+    auto *SteadyCheck = cast<CallInst>(mapped(Steady, CB));
+    Value *Bound = SteadyCheck->getArgOperand(0);
+    Value *Index = SteadyCheck->getArgOperand(1);
+    SteadyCheck->eraseFromParent();
+    RecursivelyClearAllInstructionsUsedOnlyBy(Bound);
+    RecursivelyClearAllInstructionsUsedOnlyBy(Index);
+  }
+}
+
+PreservedAnalyses IterationSpaceSplitting::run(Function &F,
+                                               FunctionAnalysisManager &FAM) {
+  if (!isCProgram(F.getParent()) && isCxxSTLFunc(F.getName())) {
+    return PreservedAnalyses::all();
+  }
+
+  auto &LI = FAM.getResult<LoopAnalysis>(F);
+  auto &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+  auto &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+
+  // innermost loops are disjoint, so they are collected before any of them
+  // is rewritten
+  SmallVector<SplitCandidate, 8> Candidates;
+  for (auto *L : LI.getLoopsInPreorder()) {
+    if (auto C = findSplitCandidate(L, SE, DT)) {
+      Candidates.push_back(*C);
+    }
+  }
+  if (Candidates.empty()) {
+    return PreservedAnalyses::all();
+  }
+
+  for (auto &C : Candidates) {
+    VERBOSE_PRINT {
+      llvm::errs() << "Split iteration space of ";
+      C.L->print(llvm::errs());
+    }
+    splitLoop(C);
+  }
+
+  VERBOSE_PRINT {
+    llvm::errs() << "Split " << Candidates.size() << " loop(s) in "
+                 << F.getName() << "\n";
+  }
+  if (DUMP_STATS)
+    CountBountCheck(F, "After Iteration Space Splitting");
+
+  return PreservedAnalyses::none();
+}
+
+IterationSpaceSplitting::~IterationSpaceSplitting() {}
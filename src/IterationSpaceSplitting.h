@@ -0,0 +1,21 @@
+#ifndef ITERATION_SPACE_SPLITTING_H
+#define ITERATION_SPACE_SPLITTING_H
+
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+/**
+ * @brief Split the iteration space of innermost loops into prologue, steady
+ * state and epilogue, so that only the boundary iterations keep the checks on
+ * the induction variable.
+ */
+class IterationSpaceSplitting
+    : public llvm::PassInfoMixin<IterationSpaceSplitting> {
+public:
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &FAM);
+  static bool isRequired() { return true; }
+  virtual ~IterationSpaceSplitting();
+};
+
+#endif // ITERATION_SPACE_SPLITTING_H
@@ -0,0 +1,126 @@
+#include "ObjectSizeCheckInsertion.h"
+#include "CommonDef.h"
+#include "Stats.h"
+#include "SubscriptExpr.h"
+#include "llvm/Analysis/MemoryBuiltins.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/InstIterator.h"
+
+using namespace llvm;
+
+/**
+ * @brief The address and the number of bytes an instruction accesses, or
+ * {nullptr, 0} if it does not access memory through a pointer operand.
+ */
+static std::pair<Value *, uint64_t> getAccessedRange(Instruction &I,
+                                                     const DataLayout &DL) {
+  Value *Ptr = nullptr;
+  Type *AccessTy = nullptr;
+  if (auto *LI = dyn_cast<LoadInst>(&I)) {
+    Ptr = LI->getPointerOperand();
+    AccessTy = LI->getType();
+  } else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+    Ptr = SI->getPointerOperand();
+    AccessTy = SI->getValueOperand()->getType();
+  } else if (auto *RMW = dyn_cast<AtomicRMWInst>(&I)) {
+    Ptr = RMW->getPointerOperand();
+    AccessTy = RMW->getValOperand()->getType();
+  } else if (auto *CmpXchg = dyn_cast<AtomicCmpXchgInst>(&I)) {
+    Ptr = CmpXchg->getPointerOperand();
+    AccessTy = CmpXchg->getCompareOperand()->getType();
+  }
+  if (!Ptr || !AccessTy->isSized() || isa<ScalableVectorType>(AccessTy)) {
+    return {nullptr, 0};
+  }
+  return {Ptr, DL.getTypeStoreSize(AccessTy).getFixedSize()};
+}
+
+PreservedAnalyses ObjectSizeCheckInsertion::run(Function &F,
+                                                FunctionAnalysisManager &FAM) {
+  if (!isCProgram(F.getParent()) && isCxxSTLFunc(F.getName())) {
+    return PreservedAnalyses::all();
+  }
+  Module *M = F.getParent();
+  const DataLayout &DL = M->getDataLayout();
+  auto &TLI = FAM.getResult<TargetLibraryAnalysis>(F);
+
+  SmallVector<std::pair<Instruction *, std::pair<Value *, uint64_t>>, 32>
+      Accesses;
+  for (auto &I : instructions(F)) {
+    auto Range = getAccessedRange(I, DL);
+    if (Range.first) {
+      Accesses.push_back({&I, Range});
+    }
+  }
+  if (Accesses.empty()) {
+    return PreservedAnalyses::all();
+  }
+
+  IRBuilder<> IRB(&*F.getEntryBlock().getFirstInsertionPt());
+  FunctionCallee CheckLower = getOrInsertCheck(*M, CHECK_LB);
+  FunctionCallee CheckUpper = getOrInsertCheck(*M, CHECK_UB);
+  Value *File = M->getNamedGlobal(SOURCE_FILE_NAME);
+  if (!File) {
+    File = IRB.CreateGlobalStringPtr(M->getSourceFileName(), SOURCE_FILE_NAME);
+  }
+
+  // allocas, globals, and calls to malloc, calloc, realloc or allocsize
+  // functions have a known size; the evaluator caches what it computed
+  ObjectSizeOpts EvalOpts;
+  EvalOpts.RoundToAlign = true;
+  ObjectSizeOffsetEvaluator ObjSizeEval(DL, &TLI, F.getContext(), EvalOpts);
+
+  // check-opt groups checks by the variable in their index and expects one
+  // coefficient per variable, while byte offsets scale it by the element
+  // size of each access. Offsets with another coefficient are kept opaque.
+  DenseMap<const Value *, int64_t> Coefficients;
+
+  unsigned Inserted = 0, StaticallySafe = 0, Unknown = 0;
+  for (auto &[I, Range] : Accesses) {
+    auto [Ptr, AccessSize] = Range;
+    SizeOffsetEvalType SizeOffset = ObjSizeEval.compute(Ptr);
+    if (!ObjSizeEval.bothKnown(SizeOffset)) {
+      Unknown++;
+      continue;
+    }
+    auto *ConstSize = dyn_cast<ConstantInt>(SizeOffset.first);
+    auto *ConstOffset = dyn_cast<ConstantInt>(SizeOffset.second);
+    if (ConstSize && ConstOffset && !ConstOffset->isNegative() &&
+        ConstOffset->getZExtValue() + AccessSize <= ConstSize->getZExtValue()) {
+      StaticallySafe++;
+      continue;
+    }
+
+    // the bytes [Offset, Offset + AccessSize) must lie in [0, Size)
+    IRB.SetInsertPoint(I);
+    Value *Size = IRB.CreateZExtOrTrunc(SizeOffset.first, IRB.getInt64Ty());
+    Value *Offset = IRB.CreateSExtOrTrunc(SizeOffset.second, IRB.getInt64Ty());
+    SubscriptExpr OffsetExpr = SubscriptExpr::evaluate(Offset);
+    if (!OffsetExpr.isConstant()) {
+      auto Iter = Coefficients.try_emplace(OffsetExpr.i, OffsetExpr.A).first;
+      if (Iter->second != OffsetExpr.A) {
+        Offset = IRB.CreateFreeze(Offset);
+      }
+    }
+    Value *Bound = IRB.CreateSub(Size, IRB.getInt64(AccessSize));
+    Value *Line = IRB.getInt64(0);
+    if (const auto &Loc = I->getDebugLoc()) {
+      Line = IRB.getInt64(Loc.getLine());
+    }
+    IRB.CreateCall(CheckUpper, {Bound, Offset, File, Line});
+    IRB.CreateCall(CheckLower, {IRB.getInt64(0), Offset, File, Line});
+    Inserted++;
+  }
+
+  VERBOSE_PRINT {
+    llvm::errs() << "Object size checks in " << F.getName() << ": "
+                 << Inserted << " inserted, " << StaticallySafe
+                 << " statically safe, " << Unknown << " unknown object\n";
+  }
+  if (DUMP_STATS)
+    CountBountCheck(F, "After Object Size Insertion");
+
+  return PreservedAnalyses::none();
+}
+
+ObjectSizeCheckInsertion::~ObjectSizeCheckInsertion() {}
@@ -0,0 +1,21 @@
+#ifndef OBJECT_SIZE_CHECK_INSERTION_H
+#define OBJECT_SIZE_CHECK_INSERTION_H
+
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+/**
+ * @brief Alternative to `access-det` and `check-ins`: check the byte range
+ * of every load and store against the size of the object it points into, as
+ * computed by MemoryBuiltins, however the address was indexed.
+ */
+class ObjectSizeCheckInsertion
+    : public llvm::PassInfoMixin<ObjectSizeCheckInsertion> {
+public:
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &FAM);
+  static bool isRequired() { return true; }
+  virtual ~ObjectSizeCheckInsertion();
+};
+
+#endif // OBJECT_SIZE_CHECK_INSERTION_H
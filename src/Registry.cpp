@@ -1,6 +1,14 @@
 #include "ArrayAccessDetection.h"
 #include "BoundCheckInsertion.h"
 #include "BoundCheckOptimization.h"
+#include "BoundParameterCloning.h"
+#include "CheckGuards.h"
+#include "CheckLowering.h"
+#include "CommonDef.h"
+#include "FunctionVersioning.h"
+#include "IterationSpaceSplitting.h"
+#include "ObjectSizeCheckInsertion.h"
+#include "TaintGuidedFiltering.h"
 #include "ValueMetadataRemoval.h"
 
 #define REGISTER_FUNC_PASS(PASS_BUILDER, NAME, CLASS)                  \
@@ -15,6 +23,19 @@
         return false;                                                  \
       });                                                              \
   } while (0)
+
+#define REGISTER_MODULE_PASS(PASS_BUILDER, NAME, CLASS)                \
+  do {                                                                 \
+    PASS_BUILDER.registerPipelineParsingCallback(                      \
+      [](StringRef Name, ModulePassManager &MPM,                       \
+         ArrayRef<PassBuilder::PipelineElement>) {                     \
+        if (Name == #NAME) {                                           \
+          MPM.addPass(CLASS());                                        \
+          return true;                                                 \
+        }                                                              \
+        return false;                                                  \
+      });                                                              \
+  } while (0)
   
 using namespace llvm;
 
@@ -29,5 +50,19 @@ llvmGetPassPluginInfo() {
             REGISTER_FUNC_PASS(PB, check-ins, BoundCheckInsertion);
             REGISTER_FUNC_PASS(PB, check-opt, BoundCheckOptimization);
             REGISTER_FUNC_PASS(PB, valuemd-rem, ValueMetadataRemoval);
+            REGISTER_FUNC_PASS(PB, check-split, IterationSpaceSplitting);
+            REGISTER_FUNC_PASS(PB, objsize-ins, ObjectSizeCheckInsertion);
+            REGISTER_FUNC_PASS(PB, check-guard, CheckGuardLowering);
+            REGISTER_FUNC_PASS(PB, check-lower, CheckLowering);
+            if (LATE_CHECK_LOWERING) {
+              PB.registerOptimizerLastEPCallback(
+                  [](ModulePassManager &MPM, OptimizationLevel) {
+                    MPM.addPass(
+                        createModuleToFunctionPassAdaptor(CheckLowering()));
+                  });
+            }
+            REGISTER_MODULE_PASS(PB, check-version, FunctionVersioning);
+            REGISTER_MODULE_PASS(PB, bound-clone, BoundParameterCloning);
+            REGISTER_MODULE_PASS(PB, taint-filter, TaintGuidedFiltering);
           }};
 }
\ No newline at end of file
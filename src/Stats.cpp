@@ -50,3 +50,18 @@ void DumpCheckCount(Function &F, const char *dst, const char *entryName,
        << ", " << CheckStat.ubCount << ", "
        << CheckStat.lbCount + CheckStat.ubCount << "\n";
 }
+
+void CountUncheckedAccesses(Function &F, const char *tableName,
+                            int accessCount) {
+  MAGENTA(llvm::errs())
+      << "╭─────────────────────────────────────────────────╮\n";
+  MAGENTA(llvm::errs()) << "│ " << tableName << "\n";
+  MAGENTA(llvm::errs()) << "│ Unchecked Accesses: " << accessCount << "\n";
+  MAGENTA(llvm::errs())
+      << "╰─────────────────────────────────────────────────╯\n";
+
+  std::ofstream file;
+  file.open(getenv("DUMP_DST"), std::ios_base::app);
+  file << F.getName().str() << ", " << tableName << ", " << accessCount
+       << "\n";
+}
@@ -14,4 +14,8 @@ struct CheckCount {
 
 CheckCount CountBountCheck(Function& F, const char* tableName);
 
-void DumpCheckCount(Function& F, const char *dst, const char* entryName, const CheckCount& CheckStat);
\ No newline at end of file
+void DumpCheckCount(Function& F, const char *dst, const char* entryName, const CheckCount& CheckStat);
+
+// accesses a policy left without checks, e.g. read-only ones under
+// WRITE_ONLY_CHECKS
+void CountUncheckedAccesses(Function& F, const char* tableName, int accessCount);
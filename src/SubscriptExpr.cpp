@@ -3,18 +3,151 @@
 #include "CommonDef.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Operator.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 
 using namespace llvm;
 
-void SubscriptExpr::mutatingAdd(int64_t c) { B += c; }
+void SubscriptExpr::mutatingAdd(int64_t c) {
+  B += c;
+  dropRange();
+}
 
-void SubscriptExpr::mutatingSub(int64_t c) { B -= c; }
+void SubscriptExpr::mutatingSub(int64_t c) {
+  B -= c;
+  dropRange();
+}
 
 void SubscriptExpr::mutatingMul(int64_t c) {
   A *= c;
   B *= c;
+  dropRange();
+}
+
+void SubscriptExpr::dropRange() {
+  Lo = INT64_MIN;
+  Hi = INT64_MAX;
+}
+
+// the values an integer of type Ty takes, read as signed
+static std::pair<int64_t, int64_t> getSignedRange(const Type *Ty) {
+  unsigned Bits = Ty->isIntegerTy() ? Ty->getIntegerBitWidth() : 64;
+  if (Bits >= 64) {
+    return {INT64_MIN, INT64_MAX};
+  }
+  return {-(int64_t(1) << (Bits - 1)), (int64_t(1) << (Bits - 1)) - 1};
+}
+
+// the largest value an integer of type Ty takes, read as unsigned
+static uint64_t getUnsignedMax(const Type *Ty) {
+  unsigned Bits = Ty->isIntegerTy() ? Ty->getIntegerBitWidth() : 64;
+  return Bits >= 64 ? UINT64_MAX : (uint64_t(1) << Bits) - 1;
+}
+
+/**
+ * @brief Narrow the range of SE to [Lo, Hi] clamped to the values of v's
+ * type. A range that does not fit the type may have wrapped and is replaced
+ * by the whole type.
+ */
+static SubscriptExpr withRange(SubscriptExpr SE, const Value *v, int64_t Lo,
+                               int64_t Hi, bool Overflowed = false) {
+  auto [TypeLo, TypeHi] = getSignedRange(v->getType());
+  if (Overflowed || Lo < TypeLo || Hi > TypeHi) {
+    Lo = TypeLo;
+    Hi = TypeHi;
+  }
+  SE.Lo = std::max(SE.Lo, Lo);
+  SE.Hi = std::min(SE.Hi, Hi);
+  return SE;
+}
+
+static SubscriptExpr withTypeRange(SubscriptExpr SE, const Value *v) {
+  auto [TypeLo, TypeHi] = getSignedRange(v->getType());
+  return withRange(SE, v, TypeLo, TypeHi);
+}
+
+/**
+ * @brief Range of the bit operations, shifts, divisions and remainders by a
+ * constant, which are opaque to the affine form.
+ */
+static SubscriptExpr evaluateOpaqueRange(const BinaryOperator *BO) {
+  SubscriptExpr Opaque{1, BO, 0};
+  auto *C = dyn_cast<ConstantInt>(BO->getOperand(1));
+  if (!C || C->getBitWidth() > 64) {
+    return withTypeRange(Opaque, BO);
+  }
+  SubscriptExpr LHS = SubscriptExpr::evaluate(BO->getOperand(0));
+  uint64_t UMax = getUnsignedMax(BO->getType());
+  uint64_t Amount = C->getZExtValue();
+  int64_t Divisor = C->getSExtValue();
+  // [0, Max] of an unsigned result, which must not look negative
+  auto withUnsignedMax = [&](uint64_t Max) {
+    return Max <= uint64_t(INT64_MAX) ? withRange(Opaque, BO, 0, int64_t(Max))
+                                      : withTypeRange(Opaque, BO);
+  };
+
+  switch (BO->getOpcode()) {
+  case Instruction::And:
+    // x & mask is within [0, mask]
+    if (!C->isNegative()) {
+      return withRange(Opaque, BO, 0, C->getSExtValue());
+    } else if (LHS.isKnownNonNegative()) {
+      return withRange(Opaque, BO, 0, LHS.Hi);
+    }
+    break;
+  case Instruction::LShr:
+    if (Amount == 0 || Amount >= C->getBitWidth()) {
+      break;
+    } else if (LHS.isKnownNonNegative()) {
+      return withRange(Opaque, BO, LHS.Lo >> Amount, LHS.Hi >> Amount);
+    }
+    return withUnsignedMax(UMax >> Amount);
+  case Instruction::AShr:
+    if (Amount < C->getBitWidth()) {
+      auto [TypeLo, TypeHi] = getSignedRange(BO->getType());
+      return withRange(Opaque, BO, std::max(LHS.Lo, TypeLo) >> Amount,
+                       std::min(LHS.Hi, TypeHi) >> Amount);
+    }
+    break;
+  case Instruction::URem:
+    if (Divisor > 0) {
+      int64_t Hi = Divisor - 1;
+      if (LHS.isKnownNonNegative()) {
+        Hi = std::min(Hi, LHS.Hi);
+      }
+      return withRange(Opaque, BO, 0, Hi);
+    }
+    break;
+  case Instruction::SRem:
+    if (Divisor > 0) {
+      int64_t Hi = Divisor - 1;
+      if (LHS.isKnownNonNegative()) {
+        return withRange(Opaque, BO, 0, std::min(Hi, LHS.Hi));
+      }
+      return withRange(Opaque, BO, -Hi, Hi);
+    }
+    break;
+  case Instruction::UDiv:
+    if (Divisor > 0) {
+      if (LHS.isKnownNonNegative()) {
+        return withRange(Opaque, BO, LHS.Lo / Divisor, LHS.Hi / Divisor);
+      }
+      return withUnsignedMax(UMax / Divisor);
+    }
+    break;
+  case Instruction::SDiv:
+    if (Divisor > 0) {
+      auto [TypeLo, TypeHi] = getSignedRange(BO->getType());
+      return withRange(Opaque, BO, std::max(LHS.Lo, TypeLo) / Divisor,
+                       std::min(LHS.Hi, TypeHi) / Divisor);
+    }
+    break;
+  default:
+    break;
+  }
+  return withTypeRange(Opaque, BO);
 }
 
 void SubscriptExpr::dump(raw_ostream &O) const {
@@ -55,11 +188,18 @@ SubscriptExpr SubscriptExpr::evaluate(const Value *v) {
   if (isa<SExtInst>(v)) {
     return evaluate(cast<SExtInst>(v)->getOperand(0));
   } else if (isa<ZExtInst>(v)) {
-    return evaluate(cast<ZExtInst>(v)->getOperand(0));
+    const auto Op = cast<ZExtInst>(v)->getOperand(0);
+    SubscriptExpr SE = evaluate(Op);
+    // the zero extended value is never negative
+    if (!SE.isKnownNonNegative()) {
+      SE.Lo = 0;
+      SE.Hi = int64_t(getUnsignedMax(Op->getType()));
+    }
+    return SE;
   } else if (isa<LoadInst>(v)) {
     const auto LI = cast<LoadInst>(v);
     const auto Ptr = LI->getPointerOperand();
-    return {1, Ptr, 0};
+    return withTypeRange({1, Ptr, 0}, v);
   } else if (isa<AddOperator>(v)) {
     const auto AO = cast<AddOperator>(v);
     const auto Op1 = AO->getOperand(0);
@@ -75,19 +215,24 @@ SubscriptExpr SubscriptExpr::evaluate(const Value *v) {
     // s2.dump(llvm::errs());
     // llvm::errs() << "#\n";
 
+    SubscriptExpr Result;
     if (s1.isConstant()) {
       // llvm::errs() << "S1 is constant\n";
-      return s2 + s1.B;
+      Result = s2 + s1.B;
     } else if (s2.isConstant()) {
       // llvm::errs() << "S2 is constant\n";
-      return s1 + s2.B;
+      Result = s1 + s2.B;
     } else if (s1.i != s2.i) {
       // llvm::errs() << "s1.i != s2.i\n";
-      return {1, v, 0};
+      Result = {1, v, 0};
     } else {
       // llvm::errs() << "????\n";
-      return s1 + s2;
+      Result = s1 + s2;
     }
+    int64_t Lo, Hi;
+    bool Overflowed = AddOverflow(s1.Lo, s2.Lo, Lo);
+    Overflowed |= AddOverflow(s1.Hi, s2.Hi, Hi);
+    return withRange(Result, v, Lo, Hi, Overflowed);
 
   } else if (isa<SubOperator>(v)) {
     const auto AO = cast<SubOperator>(v);
@@ -105,15 +250,20 @@ SubscriptExpr SubscriptExpr::evaluate(const Value *v) {
     // llvm::errs() << "#\n";
 
 
+    SubscriptExpr Result;
     if (s1.isConstant()) {
-      return {-s2.A, s2.i, s1.B - s2.B};
+      Result = {-s2.A, s2.i, s1.B - s2.B};
     } else if (s2.isConstant()) {
-      return s1 - s2.B;
+      Result = s1 - s2.B;
     } else if (s1.i != s2.i) {
-      return {1, v, 0};
+      Result = {1, v, 0};
     } else {
-      return s1 - s2;
+      Result = s1 - s2;
     }
+    int64_t Lo, Hi;
+    bool Overflowed = SubOverflow(s1.Lo, s2.Hi, Lo);
+    Overflowed |= SubOverflow(s1.Hi, s2.Lo, Hi);
+    return withRange(Result, v, Lo, Hi, Overflowed);
 
   } else if (isa<MulOperator>(v)) {
     const auto MO = cast<MulOperator>(v);
@@ -129,25 +279,38 @@ SubscriptExpr SubscriptExpr::evaluate(const Value *v) {
     // s2.dump(llvm::errs());
     // llvm::errs() << "#\n";
 
+    SubscriptExpr Result;
     if (s1.isConstant() && s2.isConstant()) {
-      return {0, nullptr, s1.B * s2.B};
+      Result = {0, nullptr, s1.B * s2.B};
     } else if (s1.isConstant()) {
-      return s2 * s1.B;
+      Result = s2 * s1.B;
     } else if (s2.isConstant()) {
-      return s1 * s2.B;
+      Result = s1 * s2.B;
     } else {
-      return {1, v, 0};
+      Result = {1, v, 0};
     }
+    // the product of two intervals is bounded by the corner products
+    int64_t Corners[4];
+    bool Overflowed = MulOverflow(s1.Lo, s2.Lo, Corners[0]);
+    Overflowed |= MulOverflow(s1.Lo, s2.Hi, Corners[1]);
+    Overflowed |= MulOverflow(s1.Hi, s2.Lo, Corners[2]);
+    Overflowed |= MulOverflow(s1.Hi, s2.Hi, Corners[3]);
+    return withRange(Result, v, *std::min_element(Corners, Corners + 4),
+                     *std::max_element(Corners, Corners + 4), Overflowed);
   } else if (isa<ConstantInt>(v)) {
     // llvm::errs() << "Constant#";
     // v->print(errs());
     // llvm::errs() << "#\n";
 
     int64_t B = cast<ConstantInt>(v)->getSExtValue();
-    return {1, nullptr, B};
+    SubscriptExpr SE{1, nullptr, B};
+    SE.Lo = SE.Hi = B;
+    return SE;
+  } else if (isa<BinaryOperator>(v)) {
+    return evaluateOpaqueRange(cast<BinaryOperator>(v));
   } else {
     // noundef?
-    return {1, v, 0};
+    return withTypeRange({1, v, 0}, v);
   }
 }
 
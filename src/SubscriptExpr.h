@@ -31,6 +31,11 @@ struct SubscriptExpr {
   const Value *i;
   int64_t B;
 
+  // signed range [Lo, Hi] of the evaluated value, as found by evaluate();
+  // arithmetic on the expression gives up the range
+  int64_t Lo = INT64_MIN;
+  int64_t Hi = INT64_MAX;
+
   SubscriptExpr(int64_t A, const Value *i, int64_t B) : A(A), i(i), B(B) {}
 
   SubscriptExpr(): A(0), i(nullptr), B(0) {}
@@ -49,6 +54,10 @@ struct SubscriptExpr {
 
   bool isConstant() const;
 
+  bool isKnownNonNegative() const { return Lo >= 0; }
+
+  void dropRange();
+
   int64_t getConstant() const;
 
   bool operator==(const SubscriptExpr &Other) const;
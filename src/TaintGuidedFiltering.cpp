@@ -0,0 +1,307 @@
+#include "TaintGuidedFiltering.h"
+#include "CommonDef.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/IntrinsicInst.h"
+
+using namespace llvm;
+
+/**
+ * @brief External functions that only print or release memory: neither their
+ * result nor the memory behind their arguments is input.
+ */
+static bool isOutputOnlyCall(const Function &Callee) {
+  return StringSwitch<bool>(Callee.getName())
+      .Cases("printf", "fprintf", "puts", "fputs", "putchar", "fputc", true)
+      .Cases("fflush", "fclose", "free", "exit", "abort", true)
+      .Default(false);
+}
+
+/**
+ * @brief Objects whose memory is tracked on its own. A pointer to anything
+ * else may point to any of them.
+ */
+static bool isIdentifiedObject(const Value *Object) {
+  return isa<AllocaInst>(Object) || isa<GlobalVariable>(Object) ||
+         isAllocationCall(Object);
+}
+
+bool TaintGuidedFiltering::isTainted(const Value *V) const {
+  return Tainted.count(V);
+}
+
+bool TaintGuidedFiltering::taint(const Value *V) {
+  return Tainted.insert(V).second;
+}
+
+bool TaintGuidedFiltering::taintMemory(const Value *Ptr) {
+  const Value *Object = getUnderlyingObject(Ptr);
+  if (isIdentifiedObject(Object)) {
+    return TaintedObjects.insert(Object).second;
+  }
+  bool Changed = !AllMemoryTainted;
+  AllMemoryTainted = true;
+  return Changed;
+}
+
+bool TaintGuidedFiltering::mayReadTaintedMemory(const Value *Ptr) const {
+  if (AllMemoryTainted) {
+    return true;
+  }
+  const Value *Object = getUnderlyingObject(Ptr);
+  if (isIdentifiedObject(Object)) {
+    return TaintedObjects.count(Object);
+  }
+  return !TaintedObjects.empty();
+}
+
+bool TaintGuidedFiltering::isBranchTainted(const BasicBlock *BB) const {
+  const Instruction *Term = BB->getTerminator();
+  if (const auto *BI = dyn_cast<BranchInst>(Term)) {
+    return BI->isConditional() && isTainted(BI->getCondition());
+  }
+  if (const auto *SI = dyn_cast<SwitchInst>(Term)) {
+    return isTainted(SI->getCondition());
+  }
+  return false;
+}
+
+/**
+ * @brief A phi also carries the taint of the branches that choose its
+ * incoming value: the exits of the loop it heads, which limit a loop counter,
+ * or any branch between the dominator of an if/else merge and the merge, so
+ * an inner `if` of nested ones counts as well.
+ */
+bool TaintGuidedFiltering::isPHITainted(const PHINode &PN, LoopInfo &LI,
+                                        DominatorTree &DT) const {
+  for (const auto &Incoming : PN.incoming_values()) {
+    if (isTainted(Incoming))
+      return true;
+  }
+  BasicBlock *BB = const_cast<BasicBlock *>(PN.getParent());
+  if (LI.isLoopHeader(BB)) {
+    SmallVector<BasicBlock *, 4> Exiting;
+    LI.getLoopFor(BB)->getExitingBlocks(Exiting);
+    return any_of(Exiting,
+                  [&](BasicBlock *E) { return isBranchTainted(E); });
+  }
+  auto *Node = DT.getNode(BB);
+  if (!Node || !Node->getIDom()) {
+    return false;
+  }
+  // every path to the merge passes its dominator, walking back from the
+  // incoming blocks ends there
+  const BasicBlock *Dom = Node->getIDom()->getBlock();
+  SmallVector<const BasicBlock *, 8> Worklist(PN.blocks());
+  SmallPtrSet<const BasicBlock *, 16> Visited;
+  while (!Worklist.empty()) {
+    const BasicBlock *Pred = Worklist.pop_back_val();
+    if (!Visited.insert(Pred).second)
+      continue;
+    if (isBranchTainted(Pred))
+      return true;
+    if (Pred != Dom)
+      Worklist.append(pred_begin(Pred), pred_end(Pred));
+  }
+  return false;
+}
+
+/**
+ * @brief Whether the size of the object Ptr points into depends on input. An
+ * object of unknown origin is taken to.
+ */
+bool TaintGuidedFiltering::isObjectSizeTainted(const Value *Ptr) const {
+  const Value *Object = getUnderlyingObject(Ptr);
+  if (isa<GlobalVariable>(Object)) {
+    return false;
+  }
+  if (const auto *AI = dyn_cast<AllocaInst>(Object)) {
+    return isTainted(AI->getArraySize());
+  }
+  if (const auto *CB = dyn_cast<CallBase>(Object)) {
+    if (isAllocationCall(CB))
+      return any_of(CB->args(), [&](const Use &U) { return isTainted(U); });
+  }
+  return true;
+}
+
+/**
+ * @brief Whether an annotated access may go out of bounds depending on input:
+ * its subscript or its bound is tainted. The container subscript is the
+ * argument of operator[] or at(). A runtime array has its base in place of a
+ * bound, the table holds the size of the object it points into.
+ */
+bool TaintGuidedFiltering::isInputDependentAccess(const Instruction &I) const {
+  const auto *CB = dyn_cast<CallBase>(&I);
+  if (CB ? isTainted(CB->getArgOperand(1))
+         : any_of(drop_begin(I.operands()),
+                  [&](const Use &U) { return isTainted(U.get()); })) {
+    return true;
+  }
+  auto *MN = cast<MDNode>(I.getMetadata(ACCESS_KEY));
+  if (MN->getNumOperands() < 2) {
+    return false;
+  }
+  auto *VAM = dyn_cast<ValueAsMetadata>(MN->getOperand(1));
+  if (!VAM) {
+    return false;
+  }
+  const Value *Bound = VAM->getValue();
+  return Bound->getType()->isPointerTy() ? isObjectSizeTainted(Bound)
+                                         : isTainted(Bound);
+}
+
+bool TaintGuidedFiltering::propagateCall(const CallBase &CB) {
+  if (isBoundCheckCall(&CB)) {
+    return false;
+  }
+  const Function *Callee = CB.getCalledFunction();
+  if (!Callee) {
+    // address taken functions take tainted arguments anyway
+    return taint(&CB);
+  }
+  bool Changed = false;
+
+  if (!Callee->isDeclaration()) {
+    for (const auto &Arg : Callee->args()) {
+      if (Arg.getArgNo() < CB.arg_size() &&
+          isTainted(CB.getArgOperand(Arg.getArgNo())))
+        Changed |= taint(&Arg);
+    }
+    if (isTainted(Callee))
+      Changed |= taint(&CB);
+    return Changed;
+  }
+
+  if (const auto *MTI = dyn_cast<MemTransferInst>(&CB)) {
+    if (isTainted(MTI->getRawSource()) ||
+        mayReadTaintedMemory(MTI->getRawSource()))
+      Changed |= taintMemory(MTI->getRawDest());
+    return Changed;
+  }
+  if (const auto *MSI = dyn_cast<MemSetInst>(&CB)) {
+    if (isTainted(MSI->getValue()))
+      Changed |= taintMemory(MSI->getRawDest());
+    return Changed;
+  }
+  if (isa<IntrinsicInst>(CB)) {
+    if (any_of(CB.args(), [&](const Use &U) { return isTainted(U.get()); }))
+      Changed |= taint(&CB);
+    return Changed;
+  }
+
+  if (isAllocationCall(&CB)) {
+    // realloc moves the contents of the old object
+    if (Callee->getName() == "realloc" &&
+        (isTainted(CB.getArgOperand(0)) ||
+         mayReadTaintedMemory(CB.getArgOperand(0))))
+      Changed |= taintMemory(&CB);
+    return Changed;
+  }
+  if (Callee->getName() == BOUND_LOOKUP || isOutputOnlyCall(*Callee)) {
+    return false;
+  }
+
+  // anything else external is a source: scanf, fread, getenv, rand...
+  Changed |= taint(&CB);
+  for (unsigned k = 0; k < CB.arg_size(); k++) {
+    if (CB.getArgOperand(k)->getType()->isPointerTy() &&
+        !CB.onlyReadsMemory(k))
+      Changed |= taintMemory(CB.getArgOperand(k));
+  }
+  return Changed;
+}
+
+bool TaintGuidedFiltering::propagate(Function &F, LoopInfo &LI,
+                                     DominatorTree &DT) {
+  bool Changed = false;
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      if (auto *SI = dyn_cast<StoreInst>(&I)) {
+        if (isTainted(SI->getValueOperand()))
+          Changed |= taintMemory(SI->getPointerOperand());
+      } else if (auto *RI = dyn_cast<ReturnInst>(&I)) {
+        if (RI->getReturnValue() && isTainted(RI->getReturnValue()))
+          Changed |= taint(&F);
+      } else if (auto *CB = dyn_cast<CallBase>(&I)) {
+        Changed |= propagateCall(*CB);
+      } else if (isTainted(&I) || isa<AllocaInst>(&I)) {
+        continue;
+      } else if (auto *PN = dyn_cast<PHINode>(&I)) {
+        if (isPHITainted(*PN, LI, DT))
+          Changed |= taint(PN);
+      } else if (auto *Load = dyn_cast<LoadInst>(&I)) {
+        // what a tainted pointer points to is input as well, like argv
+        if (isTainted(Load->getPointerOperand()) ||
+            mayReadTaintedMemory(Load->getPointerOperand()))
+          Changed |= taint(Load);
+      } else if (any_of(I.operands(),
+                        [&](const Use &U) { return isTainted(U.get()); })) {
+        Changed |= taint(&I);
+      }
+    }
+  }
+  return Changed;
+}
+
+PreservedAnalyses TaintGuidedFiltering::run(Module &M,
+                                            ModuleAnalysisManager &MAM) {
+  auto &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  // without main, any externally visible function may be called with input
+  Function *Main = M.getFunction("main");
+  for (auto &F : M) {
+    if (F.isDeclaration())
+      continue;
+    if (&F == Main || F.hasAddressTaken() ||
+        (!Main && !F.hasLocalLinkage())) {
+      for (auto &Arg : F.args())
+        taint(&Arg);
+    }
+  }
+
+  bool Changed;
+  do {
+    Changed = false;
+    for (auto &F : M) {
+      if (F.isDeclaration())
+        continue;
+      auto &LI = FAM.getResult<LoopAnalysis>(F);
+      auto &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+      Changed |= propagate(F, LI, DT);
+    }
+  } while (Changed);
+
+  bool Filtered = false;
+  for (auto &F : M) {
+    unsigned Untainted = 0;
+    for (auto &BB : F) {
+      for (auto &I : BB) {
+        if (!I.getMetadata(ACCESS_KEY))
+          continue;
+        if (!isInputDependentAccess(I)) {
+          I.setMetadata(ACCESS_KEY, nullptr);
+          Untainted++;
+        }
+      }
+    }
+    if (Untainted) {
+      VERBOSE_PRINT {
+        llvm::errs() << "Left " << Untainted << " untainted accesses in "
+                     << F.getName() << " unchecked\n";
+      }
+      Filtered = true;
+    }
+  }
+
+  VERBOSE_PRINT {
+    llvm::errs() << "Tainted " << Tainted.size() << " values and "
+                 << TaintedObjects.size() << " objects"
+                 << (AllMemoryTainted ? ", all memory may be tainted\n"
+                                      : "\n");
+  }
+  return Filtered ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
+
+TaintGuidedFiltering::~TaintGuidedFiltering() {}
@@ -0,0 +1,46 @@
+#ifndef TAINT_GUIDED_FILTERING_H
+#define TAINT_GUIDED_FILTERING_H
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+/**
+ * @brief Input-only checking: an interprocedural taint analysis marks the
+ * values derived from program input (the arguments of main, external calls
+ * and the memory they write), and the accesses annotated by access-det whose
+ * subscripts are not tainted lose their annotation, so check-ins leaves them
+ * unchecked. Runs between access-det and check-ins, after mem2reg.
+ */
+class TaintGuidedFiltering
+    : public llvm::PassInfoMixin<TaintGuidedFiltering> {
+  // tainted values, and functions that may return a tainted value
+  llvm::DenseSet<const llvm::Value *> Tainted;
+  // allocas, globals and heap allocations holding tainted data
+  llvm::DenseSet<const llvm::Value *> TaintedObjects;
+  // tainted data was written through a pointer of unknown origin
+  bool AllMemoryTainted = false;
+
+  bool isTainted(const llvm::Value *V) const;
+  bool taint(const llvm::Value *V);
+  bool taintMemory(const llvm::Value *Ptr);
+  bool mayReadTaintedMemory(const llvm::Value *Ptr) const;
+  bool isBranchTainted(const llvm::BasicBlock *BB) const;
+  bool isPHITainted(const llvm::PHINode &PN, llvm::LoopInfo &LI,
+                    llvm::DominatorTree &DT) const;
+  bool isObjectSizeTainted(const llvm::Value *Ptr) const;
+  bool isInputDependentAccess(const llvm::Instruction &I) const;
+  bool propagateCall(const llvm::CallBase &CB);
+  bool propagate(llvm::Function &F, llvm::LoopInfo &LI,
+                 llvm::DominatorTree &DT);
+
+public:
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+  static bool isRequired() { return true; }
+  virtual ~TaintGuidedFiltering();
+};
+
+#endif // TAINT_GUIDED_FILTERING_H
@@ -9,7 +9,7 @@ PreservedAnalyses ValueMetadataRemoval::run(Function &F, FunctionAnalysisManager
   }
   for (auto &BB : F) {
     for (auto &I : BB) {
-      if (I.getOpcode() == Instruction::GetElementPtr && I.getMetadata(ACCESS_KEY)) {
+      if (I.getMetadata(ACCESS_KEY)) {
         Metadata *ArrayType = I.getMetadata(ACCESS_KEY)->getOperand(0).get();
         I.setMetadata(ACCESS_KEY, MDNode::get(F.getParent()->getContext(), ArrayType));
       }
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <x86intrin.h>
+
+// Profiling variant of BoundCheck.cpp, for programs built with PROFILE_CHECKS.
+// check-lower then keeps the checks calls and records each check site in the
+// bound_profiled_sites section, where it counts the site's executions. One in
+// BOUND_PROFILE_PERIOD executions (default 1024, rounded up to a power of two)
+// of a site is bracketed with rdtsc at the call site. At exit, the sites are
+// written to stderr, or to the file named by BOUND_PROFILE_OUT, ranked by
+// their estimated cycles: executions times the mean sampled cost.
+//
+// The estimate covers the check as its caller pays for it, the argument
+// setup, the call, the compare and the return, the rdtsc overhead removed.
+// Not thread safe, like the rest of the stubs.
+
+namespace {
+
+// one entry of the bound_profiled_sites section, as laid out by check-lower
+struct Site {
+  uint64_t calls;
+  uint64_t samples;
+  uint64_t sampledCycles;
+  const char *file;
+  long long line;
+  const char *function;
+};
+
+uint64_t TimerOverhead = 0;
+
+void reportFailure(const char *file, int line) {
+  std::cerr << "\033[1;31mAssertion failed at " << file;
+  if (line > 0) {
+    std::cerr << "#" << line;
+  }
+  std::cerr << "\033[0m" << std::endl;
+}
+
+double meanCycles(const Site &site) {
+  if (!site.samples) {
+    return 0;
+  }
+  double mean = double(site.sampledCycles) / site.samples;
+  return std::max(0.0, mean - TimerOverhead);
+}
+
+uint64_t estimatedCycles(const Site &site) {
+  return uint64_t(meanCycles(site) * site.calls);
+}
+
+void writeProfile(FILE *out, const Site &site) {
+  fprintf(out, "%14" PRIu64 " %12" PRIu64 " %8" PRIu64 " %8.1f  %s#%lld",
+          estimatedCycles(site), site.calls, site.samples, meanCycles(site),
+          site.file ? site.file : "?", site.line);
+  if (site.function) {
+    fprintf(out, " (%s)", site.function);
+  }
+  fprintf(out, "\n");
+}
+
+} // namespace
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// provided by the linker when any object has profiled sites
+extern Site __start_bound_profiled_sites[] __attribute__((weak));
+extern Site __stop_bound_profiled_sites[] __attribute__((weak));
+
+// read by every profiled site, it is timed when its count has none of these
+// bits set
+uint64_t boundProfilePeriodMask = 1023;
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+
+__attribute__((constructor)) void initProfile() {
+  if (const char *value = getenv("BOUND_PROFILE_PERIOD")) {
+    uint64_t period = std::max(1ULL, strtoull(value, nullptr, 10));
+    uint64_t mask = 0;
+    while (mask + 1 < period) {
+      mask = mask << 1 | 1;
+    }
+    boundProfilePeriodMask = mask;
+  }
+  // the cheapest of a few empty brackets is what every sample pays for rdtsc,
+  // read as the sites read it, without fences
+  TimerOverhead = UINT64_MAX;
+  for (int i = 0; i < 64; i++) {
+    uint64_t start = __rdtsc();
+    uint64_t stop = __rdtsc();
+    TimerOverhead = std::min(TimerOverhead, stop - start);
+  }
+}
+
+__attribute__((destructor)) void dumpProfile() {
+  FILE *out = stderr;
+  if (const char *path = getenv("BOUND_PROFILE_OUT")) {
+    out = fopen(path, "w");
+    if (!out) {
+      out = stderr;
+    }
+  }
+  // the records stay in place, checks in later destructors still count
+  std::vector<const Site *> ranked;
+  for (Site *site = __start_bound_profiled_sites;
+       site && site < __stop_bound_profiled_sites; site++) {
+    if (site->calls) {
+      ranked.push_back(site);
+    }
+  }
+  std::sort(ranked.begin(), ranked.end(), [](const Site *a, const Site *b) {
+    return estimatedCycles(*a) > estimatedCycles(*b);
+  });
+  fprintf(out, "%14s %12s %8s %8s  %s\n", "est. cycles", "calls", "samples",
+          "mean", "site");
+  for (const Site *site : ranked) {
+    writeProfile(out, *site);
+  }
+  if (out != stderr) {
+    fclose(out);
+  }
+}
+
+} // namespace
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The sites count and time themselves, the checks only check.
+ */
+void checkLowerBound(long long bound, long long subscript, const char *file,
+                     int line) {
+  if (subscript < bound) {
+    reportFailure(file, line);
+  }
+}
+
+void checkUpperBound(long long bound, long long subscript, const char *file,
+                     int line) {
+  if (subscript > bound) {
+    reportFailure(file, line);
+  }
+}
+
+void runtimeIndexOutOfBounds(int subscript, int bound, const char *file,
+                             int line) {
+  std::cerr << "Array out of bound at " << file;
+  if (line > 0) {
+    std::cerr << "#" << line;
+  }
+  std::cerr << " while "
+            << "subscripting " << subscript << " to array of size " << bound
+            << std::endl;
+}
+
+/**
+ * @brief Reached from the trap block check-lower expands the checks to, the
+ * failing access is reported and the program stops. Lowered checks are not
+ * profiled.
+ */
+[[noreturn]] void reportBoundViolation(const char *file, long long line) {
+  reportFailure(file, line);
+  std::abort();
+}
+
+/**
+ * @brief Target of llvm.experimental.deoptimize, reached when a guard built
+ * from a check fails (GUARD_CHECKS).
+ */
+void __llvm_deoptimize(const char *file, long long line) {
+  reportBoundViolation(file, line);
+}
+
+#ifdef __cplusplus
+}
+#endif
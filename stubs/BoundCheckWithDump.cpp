@@ -1,3 +1,4 @@
+#include <cstdlib>
 #include <iostream>
 
 #ifdef __cplusplus
@@ -26,7 +27,8 @@ extern "C" {
 //   }
 // }
 
-void checkLowerBound(int bound, int subscript, const char *file, int line) {
+void checkLowerBound(long long bound, long long subscript, const char *file,
+                     int line) {
   std::cerr << "lb " << bound << "≤" << subscript << std::endl;
   if (subscript < bound) {
     std::cerr << "\033[1;31mAssertion failed at " << file;
@@ -37,7 +39,8 @@ void checkLowerBound(int bound, int subscript, const char *file, int line) {
   }
 }
 
-void checkUpperBound(int bound, int subscript, const char *file, int line) {
+void checkUpperBound(long long bound, long long subscript, const char *file,
+                     int line) {
   std::cerr << "ub \t" << subscript << "≤" << bound << std::endl;
   if (subscript > bound) {
     std::cerr << "\033[1;31mAssertion failed at " << file;
@@ -59,6 +62,28 @@ void runtimeIndexOutOfBounds(int subscript, int bound, const char *file,
             << std::endl;
 }
 
+/**
+ * @brief Reached from the trap block check-lower expands the checks to, the
+ * failing access is reported and the program stops.
+ */
+[[noreturn]] void reportBoundViolation(const char *file, long long line) {
+  std::cerr << "\033[1;31mAssertion failed at " << file;
+  if (line > 0) {
+    std::cerr << "#" << line;
+  }
+  std::cerr << "\033[0m" << std::endl;
+  std::abort();
+}
+
+/**
+ * @brief Target of llvm.experimental.deoptimize, reached when a guard built
+ * from a check fails (GUARD_CHECKS). There is no interpreter to resume in, so
+ * the failure is reported like a check and the program stops.
+ */
+void __llvm_deoptimize(const char *file, long long line) {
+  reportBoundViolation(file, line);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,191 @@
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <sys/mman.h>
+
+// Runtime bounds table, used by checks on pointers whose allocation the
+// compiler cannot see. malloc/calloc/realloc/aligned_alloc/free are
+// interposed to record the size of every live heap object in an open
+// addressing hash table keyed by its base address. Lookups of interior or unknown pointers answer with
+// an unbounded size, so such accesses are never reported.
+//
+// The table lives in mmap'd memory so that it never calls back into malloc.
+// It is not thread safe, like the rest of the stubs.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+
+struct Entry {
+  uintptr_t base; // 0 marks an empty slot
+  size_t size;
+};
+
+constexpr size_t INITIAL_CAPACITY = 1 << 12;
+
+Entry *Table = nullptr;
+size_t Capacity = 0; // always a power of two
+size_t Count = 0;
+
+inline size_t slotOf(uintptr_t base) {
+  // allocations are 16 byte aligned, the low bits carry no information
+  return ((base >> 4) * 0x9E3779B97F4A7C15ULL) & (Capacity - 1);
+}
+
+Entry *allocateTable(size_t capacity) {
+  void *mem = mmap(nullptr, capacity * sizeof(Entry), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return mem == MAP_FAILED ? nullptr : static_cast<Entry *>(mem);
+}
+
+void insertEntry(uintptr_t base, size_t size);
+
+void grow() {
+  Entry *old = Table;
+  size_t oldCapacity = Capacity;
+  size_t capacity = oldCapacity ? oldCapacity * 2 : INITIAL_CAPACITY;
+  Entry *table = allocateTable(capacity);
+  if (!table) {
+    return;
+  }
+  Table = table;
+  Capacity = capacity;
+  Count = 0;
+  for (size_t i = 0; i < oldCapacity; i++) {
+    if (old[i].base) {
+      insertEntry(old[i].base, old[i].size);
+    }
+  }
+  if (old) {
+    munmap(old, oldCapacity * sizeof(Entry));
+  }
+}
+
+void insertEntry(uintptr_t base, size_t size) {
+  // keep the load factor below 1/2 so probe sequences stay short
+  if ((Count + 1) * 2 > Capacity) {
+    grow();
+    if ((Count + 1) * 2 > Capacity) {
+      return;
+    }
+  }
+  size_t i = slotOf(base);
+  while (Table[i].base && Table[i].base != base) {
+    i = (i + 1) & (Capacity - 1);
+  }
+  if (!Table[i].base) {
+    Count++;
+  }
+  Table[i] = {base, size};
+}
+
+void eraseEntry(uintptr_t base) {
+  // free(NULL): 0 marks the empty slots, there is no entry to erase
+  if (!Table || !base) {
+    return;
+  }
+  size_t i = slotOf(base);
+  while (Table[i].base != base) {
+    if (!Table[i].base) {
+      return;
+    }
+    i = (i + 1) & (Capacity - 1);
+  }
+  // backward shift deletion, no tombstones to skip on later probes
+  size_t hole = i;
+  for (size_t j = (hole + 1) & (Capacity - 1); Table[j].base;
+       j = (j + 1) & (Capacity - 1)) {
+    size_t home = slotOf(Table[j].base);
+    // move j into the hole unless its home lies cyclically in (hole, j]
+    bool homeInRange = hole <= j ? (hole < home && home <= j)
+                                 : (hole < home || home <= j);
+    if (!homeInRange) {
+      Table[hole] = Table[j];
+      hole = j;
+    }
+  }
+  Table[hole] = {0, 0};
+  Count--;
+}
+
+} // namespace
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void *malloc(size_t size) {
+  void *ptr = __libc_malloc(size);
+  if (ptr) {
+    insertEntry(reinterpret_cast<uintptr_t>(ptr), size);
+  }
+  return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  void *ptr = __libc_calloc(nmemb, size);
+  if (ptr) {
+    insertEntry(reinterpret_cast<uintptr_t>(ptr), nmemb * size);
+  }
+  return ptr;
+}
+
+void *realloc(void *old, size_t size) {
+  void *ptr = __libc_realloc(old, size);
+  if (ptr || size == 0) {
+    eraseEntry(reinterpret_cast<uintptr_t>(old));
+  }
+  if (ptr) {
+    insertEntry(reinterpret_cast<uintptr_t>(ptr), size);
+  }
+  return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  void *ptr = __libc_memalign(alignment, size);
+  if (ptr) {
+    insertEntry(reinterpret_cast<uintptr_t>(ptr), size);
+  }
+  return ptr;
+}
+
+void free(void *ptr) {
+  eraseEntry(reinterpret_cast<uintptr_t>(ptr));
+  __libc_free(ptr);
+}
+
+/**
+ * @brief Number of elements of elemSize bytes in the heap object starting at
+ * base, or LLONG_MAX if base is not the start of a live heap object.
+ */
+long long lookupBound(const void *base, long long elemSize) {
+  uintptr_t key = reinterpret_cast<uintptr_t>(base);
+  if (!Table || !key || elemSize <= 0) {
+    return LLONG_MAX;
+  }
+  for (size_t i = slotOf(key);; i = (i + 1) & (Capacity - 1)) {
+    const Entry &e = Table[i];
+    if (e.base == key) {
+      return static_cast<long long>(e.size / elemSize);
+    }
+    if (!e.base) {
+      return LLONG_MAX;
+    }
+  }
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,137 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Runtime of the patchable checks (PATCHABLE_CHECKS). check-lower emits each
+// check as a five byte NOP followed by the code it guards; the check itself is
+// out of line. Enabling a site rewrites its NOP into a `jmp` to the check,
+// disabling it writes the NOP back. All sites start disabled, set
+// BOUND_CHECKS=all, or a comma separated list of (mangled) function names, to
+// enable sites at startup.
+//
+// Patching is not atomic: no other thread may run a site while it is
+// switched. Like the rest of the stubs, this is x86-64 and ELF only.
+
+namespace {
+
+// one entry of the bound_check_sleds section, as laid out by check-lower
+struct SledRecord {
+  uintptr_t sled;
+  uintptr_t check;
+  const char *function;
+  const char *file; // nullptr if unknown
+  long long line;
+};
+
+constexpr unsigned char NOP5[5] = {0x0f, 0x1f, 0x44, 0x00, 0x00};
+constexpr unsigned char JMP_REL32 = 0xe9;
+
+} // namespace
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// provided by the linker when any object has sleds
+extern const SledRecord __start_bound_check_sleds[] __attribute__((weak));
+extern const SledRecord __stop_bound_check_sleds[] __attribute__((weak));
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+
+bool patchSled(const SledRecord &r, bool enable) {
+  uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  uintptr_t start = r.sled & ~(page - 1);
+  // a sled may straddle two pages
+  size_t length = r.sled + sizeof(NOP5) - start;
+  if (mprotect(reinterpret_cast<void *>(start), length,
+               PROT_READ | PROT_WRITE | PROT_EXEC)) {
+    return false;
+  }
+  unsigned char *code = reinterpret_cast<unsigned char *>(r.sled);
+  if (enable) {
+    int32_t offset = static_cast<int32_t>(r.check - (r.sled + sizeof(NOP5)));
+    code[0] = JMP_REL32;
+    memcpy(code + 1, &offset, sizeof(offset));
+  } else {
+    memcpy(code, NOP5, sizeof(NOP5));
+  }
+  mprotect(reinterpret_cast<void *>(start), length, PROT_READ | PROT_EXEC);
+  return true;
+}
+
+template <typename Pred> long long patchSleds(bool enable, Pred matches) {
+  long long patched = 0;
+  for (const SledRecord *r = __start_bound_check_sleds;
+       r && r < __stop_bound_check_sleds; r++) {
+    if (matches(*r) && patchSled(*r, enable)) {
+      patched++;
+    }
+  }
+  return patched;
+}
+
+} // namespace
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Switch every check site of the program.
+ *
+ * @return the number of sites switched
+ */
+long long setBoundChecks(int enable) {
+  return patchSleds(enable, [](const SledRecord &) { return true; });
+}
+
+/**
+ * @brief Switch the check sites of the function with the given (mangled)
+ * name.
+ */
+long long setFunctionBoundChecks(const char *function, int enable) {
+  return patchSleds(enable, [&](const SledRecord &r) {
+    return strcmp(r.function, function) == 0;
+  });
+}
+
+/**
+ * @brief Switch the check sites of a source line. Sites compiled without debug
+ * information are all on line 0.
+ */
+long long setBoundCheckSite(const char *file, long long line, int enable) {
+  return patchSleds(enable, [&](const SledRecord &r) {
+    return r.line == line && r.file && strcmp(r.file, file) == 0;
+  });
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+__attribute__((constructor)) static void enableBoundChecksFromEnv() {
+  const char *value = getenv("BOUND_CHECKS");
+  if (!value || !*value) {
+    return;
+  }
+  if (strcmp(value, "all") == 0) {
+    setBoundChecks(1);
+    return;
+  }
+  // a list of function names
+  while (*value) {
+    const char *end = strchr(value, ',');
+    size_t length = end ? static_cast<size_t>(end - value) : strlen(value);
+    patchSleds(true, [&](const SledRecord &r) {
+      return strncmp(r.function, value, length) == 0 &&
+             r.function[length] == '\0';
+    });
+    value += end ? length + 1 : length;
+  }
+}
@@ -0,0 +1,45 @@
+#include <cstdio>
+
+// Exit report of INDEX_MASKING. check-ins clamps the subscripts of masked
+// sites into their bounds and records each site in the bound_masked_sites
+// section. A function that clamped an access sets the site's violated flag
+// when it returns or calls what may not return. The sites with a set
+// flag are reported on stderr when the program exits; the exit status is
+// left alone, the accesses themselves stayed in bounds.
+
+namespace {
+
+// one entry of the bound_masked_sites section, as laid out by check-ins
+struct MaskedSite {
+  unsigned char violated;
+  const char *file;
+  long long line;
+};
+
+} // namespace
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// provided by the linker when any object has masked sites
+extern MaskedSite __start_bound_masked_sites[] __attribute__((weak));
+extern MaskedSite __stop_bound_masked_sites[] __attribute__((weak));
+
+#ifdef __cplusplus
+}
+#endif
+
+__attribute__((destructor)) static void reportMaskedSites() {
+  for (MaskedSite *s = __start_bound_masked_sites;
+       s && s < __stop_bound_masked_sites; s++) {
+    if (!s->violated) {
+      continue;
+    }
+    fprintf(stderr, "\033[1;31mSubscript clamped at %s", s->file);
+    if (s->line > 0) {
+      fprintf(stderr, "#%lld", s->line);
+    }
+    fprintf(stderr, "\033[0m\n");
+  }
+}
@@ -1 +1,5 @@
-clang++ -c BoundCheck.cpp -o BoundCheck.o
\ No newline at end of file
+clang++ -c BoundCheck.cpp -o BoundCheck.o
+clang++ -c BoundTable.cpp -o BoundTable.o
+clang++ -c CheckSleds.cpp -o CheckSleds.o
+clang++ -O2 -c BoundCheckProfile.cpp -o BoundCheckProfile.o
+clang++ -c MaskedSites.cpp -o MaskedSites.o
@@ -0,0 +1,46 @@
+; RUN: %opt -passes=access-det,check-ins,valuemd-rem -S %s | FileCheck %s
+
+; libstdc++'s at() indexes through operator[], libc++ tags its inline
+; members with an ABI tag. Both are checked against the vector size.
+
+define linkonce_odr ptr @_ZNSt6vectorIiSaIiEEixEm(ptr %this, i64 %n) {
+  %b = load ptr, ptr %this
+  %p = getelementptr inbounds i32, ptr %b, i64 %n
+  ret ptr %p
+}
+
+define linkonce_odr void @_ZNKSt6vectorIiSaIiEE14_M_range_checkEm(ptr %this, i64 %n) {
+  ret void
+}
+
+define linkonce_odr ptr @_ZNSt6vectorIiSaIiEE2atEm(ptr %this, i64 %n) {
+  call void @_ZNKSt6vectorIiSaIiEE14_M_range_checkEm(ptr %this, i64 %n)
+  %r = call ptr @_ZNSt6vectorIiSaIiEEixEm(ptr %this, i64 %n)
+  ret ptr %r
+}
+
+define linkonce_odr ptr @_ZNSt3__16vectorIiNS_9allocatorIiEEEixB7v160006Em(ptr %this, i64 %n) {
+  %b = load ptr, ptr %this
+  %p = getelementptr inbounds i32, ptr %b, i64 %n
+  ret ptr %p
+}
+
+; CHECK-LABEL: define i32 @_Z3getRSt6vectorIiSaIiEEi(
+; CHECK: %vec.size = sdiv exact i64
+; CHECK: call void @checkUpperBound(
+; CHECK: call void @checkLowerBound(
+; CHECK-NEXT: %e = call ptr @_ZNSt6vectorIiSaIiEE2atEm(
+; CHECK: %vec.size4 = sdiv exact i64
+; CHECK: call void @checkUpperBound(
+; CHECK: call void @checkLowerBound(
+; CHECK-NEXT: %f = call ptr @_ZNSt3__16vectorIiNS_9allocatorIiEEEixB7v160006Em(
+define i32 @_Z3getRSt6vectorIiSaIiEEi(ptr %v, ptr %w, i32 %k) {
+entry:
+  %i = sext i32 %k to i64
+  %e = call ptr @_ZNSt6vectorIiSaIiEE2atEm(ptr %v, i64 %i)
+  %x = load i32, ptr %e
+  %f = call ptr @_ZNSt3__16vectorIiNS_9allocatorIiEEEixB7v160006Em(ptr %w, i64 %i)
+  %y = load i32, ptr %f
+  %s = add i32 %x, %y
+  ret i32 %s
+}
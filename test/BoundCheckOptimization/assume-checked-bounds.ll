@@ -0,0 +1,68 @@
+; RUN: %opt -passes=check-opt -S %s | FileCheck %s
+
+; A check is followed by the assumption of its predicate only when the load or
+; store it guards always follows it. Addresses that are only formed or
+; compared and at() calls may be out of bounds in a valid program.
+
+@a = global [100 x i32] zeroinitializer
+@__source_file_name__ = private constant [4 x i8] c"t.c\00"
+
+declare void @checkLowerBound(i64, i64, ptr, i64)
+declare void @checkUpperBound(i64, i64, ptr, i64)
+declare ptr @_ZNSt6vectorIiSaIiEE2atEm(ptr, i64)
+
+; CHECK-LABEL: define i32 @load(
+; CHECK: call void @checkUpperBound(i64 99, i64 %i,
+; CHECK-NEXT: %[[UB:.*]] = icmp sle i64 %i, 99
+; CHECK-NEXT: call void @llvm.assume(i1 %[[UB]])
+; CHECK: call void @checkLowerBound(i64 0, i64 %i,
+; CHECK-NEXT: %[[LB:.*]] = icmp sle i64 0, %i
+; CHECK-NEXT: call void @llvm.assume(i1 %[[LB]])
+define i32 @load(i64 %i) {
+entry:
+  call void @checkUpperBound(i64 99, i64 %i, ptr @__source_file_name__, i64 1)
+  call void @checkLowerBound(i64 0, i64 %i, ptr @__source_file_name__, i64 1)
+  %p = getelementptr inbounds [100 x i32], ptr @a, i64 0, i64 %i
+  %v = load i32, ptr %p
+  ret i32 %v
+}
+
+; CHECK-LABEL: define i1 @end_pointer(
+; CHECK-NOT: @llvm.assume
+; CHECK: ret i1
+define i1 @end_pointer(i64 %i, ptr %q) {
+entry:
+  call void @checkUpperBound(i64 99, i64 %i, ptr @__source_file_name__, i64 2)
+  %p = getelementptr inbounds [100 x i32], ptr @a, i64 0, i64 %i
+  %c = icmp eq ptr %p, %q
+  ret i1 %c
+}
+
+; CHECK-LABEL: define void @conditional_store(
+; CHECK-NOT: @llvm.assume
+; CHECK: ret void
+define void @conditional_store(i64 %i, i1 %c) {
+entry:
+  call void @checkUpperBound(i64 99, i64 %i, ptr @__source_file_name__, i64 3)
+  %p = getelementptr inbounds [100 x i32], ptr @a, i64 0, i64 %i
+  br i1 %c, label %then, label %exit
+
+then:
+  store i32 0, ptr %p
+  br label %exit
+
+exit:
+  ret void
+}
+
+; CHECK-LABEL: define i32 @at(
+; CHECK-NOT: @llvm.assume
+; CHECK: ret i32
+define i32 @at(ptr %v, i64 %i, i64 %n) {
+entry:
+  %last = sub i64 %n, 1
+  call void @checkUpperBound(i64 %last, i64 %i, ptr @__source_file_name__, i64 4)
+  %p = call ptr @_ZNSt6vectorIiSaIiEE2atEm(ptr %v, i64 %i)
+  %x = load i32, ptr %p
+  ret i32 %x
+}
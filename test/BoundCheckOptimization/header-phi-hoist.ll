@@ -0,0 +1,62 @@
+; RUN: %opt -passes=check-opt -S %s | FileCheck %s
+
+; A check on the header phi of a monotonic loop is hoisted with the phi's
+; incoming value, its extreme value, in place of the phi.
+
+@a = global [100 x i32] zeroinitializer
+@__source_file_name__ = private constant [4 x i8] c"t.c\00"
+
+declare void @checkLowerBound(i64, i64, ptr, i64)
+declare void @checkUpperBound(i64, i64, ptr, i64)
+
+; CHECK-LABEL: define void @down(
+; CHECK: entry:
+; CHECK-NEXT: call void @checkUpperBound(i64 99, i64 50,
+; CHECK: for.cond:
+; CHECK-NOT: call void @check
+; CHECK: ret void
+define void @down() {
+entry:
+  br label %for.cond
+
+for.cond:
+  %i = phi i64 [ 50, %entry ], [ %dec, %for.body ]
+  call void @checkUpperBound(i64 99, i64 %i, ptr @__source_file_name__, i64 1)
+  %cmp = icmp ult i64 %i, 100
+  br i1 %cmp, label %for.body, label %for.end
+
+for.body:
+  %p = getelementptr inbounds [100 x i32], ptr @a, i64 0, i64 %i
+  store i32 0, ptr %p
+  %dec = sub i64 %i, 2
+  br label %for.cond
+
+for.end:
+  ret void
+}
+
+; CHECK-LABEL: define void @up(
+; CHECK: entry:
+; CHECK-NEXT: call void @checkLowerBound(i64 5, i64 10,
+; CHECK: for.cond:
+; CHECK-NOT: call void @check
+; CHECK: ret void
+define void @up() {
+entry:
+  br label %for.cond
+
+for.cond:
+  %i = phi i64 [ 10, %entry ], [ %inc, %for.body ]
+  call void @checkLowerBound(i64 5, i64 %i, ptr @__source_file_name__, i64 2)
+  %cmp = icmp sge i64 %i, 0
+  br i1 %cmp, label %for.body, label %for.end
+
+for.body:
+  %p = getelementptr inbounds [100 x i32], ptr @a, i64 0, i64 %i
+  store i32 0, ptr %p
+  %inc = add i64 %i, 3
+  br label %for.cond
+
+for.end:
+  ret void
+}
@@ -0,0 +1,68 @@
+; RUN: %opt -passes=check-split -S %s | FileCheck %s
+
+; A segment leaving on its limit hands the iteration to the next segment,
+; whose header evaluates the loop condition again. Loops whose header has
+; side effects are not split.
+
+@a = global [100 x i32] zeroinitializer
+@file = private constant [4 x i8] c"t.c\00"
+
+declare void @checkLowerBound(i64, i64, ptr, i64)
+declare void @checkUpperBound(i64, i64, ptr, i64)
+declare i1 @next(ptr)
+
+; CHECK-LABEL: define void @pure(
+; CHECK: for.cond.prologue:
+; CHECK: for.cond.steady:
+define void @pure(i64 %n) {
+entry:
+  br label %for.cond
+
+for.cond:
+  %i = phi i64 [ 0, %entry ], [ %inc, %for.body ]
+  %cmp = icmp slt i64 %i, %n
+  br i1 %cmp, label %for.body, label %for.end
+
+for.body:
+  %j = add nsw i64 %i, 3
+  call void @checkUpperBound(i64 99, i64 %j, ptr @file, i64 1)
+  call void @checkLowerBound(i64 0, i64 %j, ptr @file, i64 1)
+  %p = getelementptr inbounds [100 x i32], ptr @a, i64 0, i64 %j
+  store i32 0, ptr %p
+  %inc = add nsw i64 %i, 1
+  br label %for.cond
+
+for.end:
+  ret void
+}
+
+; CHECK-LABEL: define void @effectful(
+; CHECK-NOT: .prologue
+; CHECK-NOT: .steady
+; CHECK: call i1 @next(ptr %s)
+; CHECK-NOT: .prologue
+; CHECK-NOT: .steady
+; CHECK: ret void
+define void @effectful(i64 %n, ptr %s) {
+entry:
+  br label %for.cond
+
+for.cond:
+  %i = phi i64 [ 0, %entry ], [ %inc, %for.body ]
+  %more = call i1 @next(ptr %s)
+  %cmp = icmp slt i64 %i, %n
+  %go = and i1 %cmp, %more
+  br i1 %go, label %for.body, label %for.end
+
+for.body:
+  %j = add nsw i64 %i, 3
+  call void @checkUpperBound(i64 99, i64 %j, ptr @file, i64 1)
+  call void @checkLowerBound(i64 0, i64 %j, ptr @file, i64 1)
+  %p = getelementptr inbounds [100 x i32], ptr @a, i64 0, i64 %j
+  store i32 0, ptr %p
+  %inc = add nsw i64 %i, 1
+  br label %for.cond
+
+for.end:
+  ret void
+}
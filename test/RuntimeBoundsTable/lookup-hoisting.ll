@@ -0,0 +1,61 @@
+; RUN: %opt -passes=check-opt -S %s | FileCheck %s
+
+; Bounds table lookups of a base are merged and moved up to its definition,
+; but never across a call that may free or reallocate an object.
+
+@__source_file_name__ = private constant [4 x i8] c"t.c\00"
+
+declare void @checkLowerBound(i64, i64, ptr, i64)
+declare void @checkUpperBound(i64, i64, ptr, i64)
+declare i64 @lookupBound(ptr, i64) readonly nounwind willreturn
+declare void @free(ptr)
+declare ptr @realloc(ptr, i64)
+declare void @use(ptr) readonly
+
+; CHECK-LABEL: define void @nofree(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %b1 = call i64 @lookupBound(ptr %p, i64 4)
+; CHECK-NEXT: call void @use(ptr %p)
+; CHECK-NOT: @lookupBound
+; CHECK: %ub2 = sub i64 %b1, 1
+define void @nofree(ptr %p, i64 %i, i64 %j) {
+entry:
+  call void @use(ptr %p)
+  %b1 = call i64 @lookupBound(ptr %p, i64 4)
+  %ub1 = sub i64 %b1, 1
+  call void @checkUpperBound(i64 %ub1, i64 %i, ptr @__source_file_name__, i64 1)
+  %x = getelementptr inbounds i32, ptr %p, i64 %i
+  store i32 0, ptr %x
+  %b2 = call i64 @lookupBound(ptr %p, i64 4)
+  %ub2 = sub i64 %b2, 1
+  call void @checkUpperBound(i64 %ub2, i64 %j, ptr @__source_file_name__, i64 2)
+  %y = getelementptr inbounds i32, ptr %p, i64 %j
+  store i32 0, ptr %y
+  ret void
+}
+
+; CHECK-LABEL: define void @withfree(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: call void @free(ptr %q)
+; CHECK-NEXT: %b1 = call i64 @lookupBound(ptr %p, i64 4)
+; CHECK: %r = call ptr @realloc(ptr %p, i64 400)
+; CHECK-NEXT: %b2 = call i64 @lookupBound(ptr %p, i64 4)
+; CHECK: %ub2 = sub i64 %b2, 1
+define void @withfree(ptr %p, ptr %q, i64 %i, i64 %j) {
+entry:
+  call void @free(ptr %q)
+  %k = add i64 %i, 1
+  %b1 = call i64 @lookupBound(ptr %p, i64 4)
+  %ub1 = sub i64 %b1, 1
+  call void @checkUpperBound(i64 %ub1, i64 %k, ptr @__source_file_name__, i64 1)
+  %x = getelementptr inbounds i32, ptr %p, i64 %k
+  store i32 0, ptr %x
+  %r = call ptr @realloc(ptr %p, i64 400)
+  %l = add i64 %j, 1
+  %b2 = call i64 @lookupBound(ptr %p, i64 4)
+  %ub2 = sub i64 %b2, 1
+  call void @checkUpperBound(i64 %ub2, i64 %l, ptr @__source_file_name__, i64 2)
+  %y = getelementptr inbounds i32, ptr %p, i64 %l
+  store i32 0, ptr %y
+  ret void
+}
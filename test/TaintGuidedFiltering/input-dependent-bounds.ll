@@ -0,0 +1,58 @@
+; RUN: %opt -passes='function(access-det),taint-filter,function(check-ins,valuemd-rem)' -S %s | FileCheck %s
+
+; An access is input dependent when its bound is: %a has a size read by
+; scanf. A phi is when any branch between its dominator and it is: only the
+; inner if of the merge tests argc.
+
+@g = global [16 x i32] zeroinitializer
+@h = global i32 0
+@.fmt = private constant [3 x i8] c"%d\00"
+
+declare ptr @malloc(i64)
+declare i32 @__isoc99_scanf(ptr, ...)
+
+; CHECK-LABEL: define i32 @main(
+; CHECK: loop:
+; CHECK: call void @checkUpperBound(i64 %{{.*}}, i64 %i,
+; CHECK: call void @checkLowerBound(i64 0, i64 %i,
+; CHECK: merge:
+; CHECK: call void @checkUpperBound(i64 15, i64 %k,
+define i32 @main(i32 %argc, ptr %argv) {
+entry:
+  %slot = alloca i32
+  %r = call i32 (ptr, ...) @__isoc99_scanf(ptr @.fmt, ptr %slot)
+  %n = load i32, ptr %slot
+  %n64 = sext i32 %n to i64
+  %bytes = mul i64 %n64, 4
+  %a = call ptr @malloc(i64 %bytes)
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %p = getelementptr inbounds i32, ptr %a, i64 %i
+  store i32 0, ptr %p
+  %inc = add nsw i64 %i, 1
+  %done = icmp eq i64 %inc, 100
+  br i1 %done, label %after, label %loop
+
+after:
+  %c = icmp sgt i32 %argc, 100
+  %hv = load i32, ptr @h
+  %c0 = icmp eq i32 %hv, 0
+  br i1 %c0, label %outer, label %merge
+
+outer:
+  br i1 %c, label %t, label %f
+
+t:
+  br label %merge
+
+f:
+  br label %merge
+
+merge:
+  %k = phi i64 [ 1, %after ], [ 2, %t ], [ 30, %f ]
+  %q = getelementptr inbounds [16 x i32], ptr @g, i64 0, i64 %k
+  store i32 1, ptr %q
+  ret i32 0
+}
@@ -0,0 +1,20 @@
+import os
+
+import lit.formats
+
+config.name = "proj1"
+config.test_format = lit.formats.ShTest(True)
+config.suffixes = [".ll"]
+config.test_source_root = os.path.dirname(__file__)
+
+# passed by the check target, see CMakeLists.txt
+plugin = lit_config.params.get("plugin")
+tools_dir = lit_config.params.get("llvm_tools_dir")
+if not plugin or not tools_dir:
+    lit_config.fatal("run with --param plugin=<libproj1> "
+                     "--param llvm_tools_dir=<LLVM bin directory>")
+
+config.environment["PATH"] = os.pathsep.join(
+    [tools_dir, config.environment.get("PATH", "")])
+config.substitutions.append(
+    ("%opt", "opt -opaque-pointers -load-pass-plugin " + plugin))